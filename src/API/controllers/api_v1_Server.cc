@@ -1,4 +1,5 @@
 #include "api_v1_Server.h"
+#include "../../src/databases/ctxt_codec.hpp"
 
 using namespace api::v1;
 using namespace std;
@@ -65,6 +66,59 @@ std::vector<std::pair<uint32_t, uint32_t>> parseStringUU(const std::string &s)
     return result;
 }
 
+// "[[(0,1)],[(1,2),(2,0)]]" -> {"[(0,1)]", "[(1,2),(2,0)]"}
+std::vector<std::string> splitQueryList(const std::string &s)
+{
+    std::vector<std::string> result;
+    int depth = 0;
+    size_t start = 0;
+
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '[')
+        {
+            depth++;
+            if (depth == 2)
+            {
+                start = i;
+            }
+        }
+        else if (s[i] == ']')
+        {
+            if (depth == 2)
+            {
+                result.push_back(s.substr(start, i - start + 1));
+            }
+            depth--;
+        }
+    }
+    if (depth != 0)
+    {
+        std::cerr << "Invalid format: " << s << std::endl;
+        return {};
+    }
+    return result;
+}
+
+// "[1,0,1]" -> {true, false, true}
+std::vector<bool> parseConjunctiveList(const std::string &s)
+{
+    std::vector<bool> result;
+    for (char c : s)
+    {
+        if (c == '0' || c == '1')
+        {
+            result.push_back(c == '1');
+        }
+        else if (c != '[' && c != ']' && c != ',' && c != ' ')
+        {
+            std::cerr << "Invalid format: " << s << std::endl;
+            return {};
+        }
+    }
+    return result;
+}
+
 void print_vector(const std::vector<std::string> &v)
 {
     for (const std::string &s : v)
@@ -228,7 +282,7 @@ void Server::countingQueryAPI(const HttpRequestPtr &req,
         return;
     }
 
-    helib::Ctxt result = squid.countQuery(conjunctive, pairs);
+    helib::Ctxt result = squid.executeCountQuery(conjunctive, pairs);
 
     auto ksk = key_switch_store.at(apikey);
 
@@ -242,6 +296,65 @@ void Server::countingQueryAPI(const HttpRequestPtr &req,
     callback(resp);
 }
 
+void Server::batchCountingQueryAPI(const HttpRequestPtr &req,
+                                   std::function<void(const HttpResponsePtr &)> &&callback,
+                                   std::string queries,
+                                   std::string conj,
+                                   const std::string &apikey) const
+{
+    LOG_DEBUG << "Running batch counting query with " << queries << " from user with API Key: " << apikey;
+
+    Json::Value ret;
+
+    if (apikey != MasterApiKey)
+    {
+        ret["result"] = "failed";
+        auto resp = HttpResponse::newHttpJsonResponse(ret);
+        callback(resp);
+        return;
+    }
+
+    std::vector<std::string> filters = splitQueryList(queries);
+    std::vector<bool> conjunctives = parseConjunctiveList(conj);
+
+    if (filters.size() == 0 || filters.size() != conjunctives.size())
+    {
+        ret["result"] = "queries and conjunctives failed to parse or do not match";
+        auto resp = HttpResponse::newHttpJsonResponse(ret);
+        callback(resp);
+        return;
+    }
+
+    std::vector<CountQuery> batch;
+    for (size_t i = 0; i < filters.size(); i++)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> pairs = parseStringUU(filters[i]);
+        if (pairs.size() == 0)
+        {
+            ret["result"] = "query " + std::to_string(i) + " failed to parse or is empty";
+            auto resp = HttpResponse::newHttpJsonResponse(ret);
+            callback(resp);
+            return;
+        }
+        batch.push_back(CountQuery{conjunctives[i], pairs});
+    }
+
+    helib::Ctxt result = squid.batchCountQuery(batch);
+
+    // One key switch and one serialization for the whole batch
+    auto ksk = key_switch_store.at(apikey);
+
+    result.PublicKeySwitch(std::make_pair(std::ref(ksk.first), std::ref(ksk.second)));
+
+    std::stringstream ss;
+    result.writeToJSON(ss);
+    ret["result"] = ss.str();
+    ret["num_queries"] = batch.size();
+
+    auto resp = HttpResponse::newHttpJsonResponse(ret);
+    callback(resp);
+}
+
 void Server::mafQueryAPI(const HttpRequestPtr &req,
                          std::function<void(const HttpResponsePtr &)> &&callback,
                          std::string query,
@@ -312,7 +425,7 @@ void Server::mafQueryAPI(const HttpRequestPtr &req,
         return;
     }
 
-    helib::Ctxt result = squid.MAFQuery(i_target, conjunctive, pairs);
+    helib::Ctxt result = squid.executeMAFQuery(i_target, conjunctive, pairs);
 
     auto ksk = key_switch_store.at(apikey);
 
@@ -353,7 +466,7 @@ void Server::PRSQueryAPI(const HttpRequestPtr &req,
         return;
     }
 
-    std::vector<helib::Ctxt> results = squid.PRSQuery(pairs);
+    std::vector<helib::Ctxt> results = squid.executePRSQuery(pairs);
     uint32_t num_rows = squid.getNumRows();
 
     auto ksk = key_switch_store.at(apikey);
@@ -394,26 +507,47 @@ void Server::similarityQueryAPI(const HttpRequestPtr &req,
         return;
     }
 
-    std::string temp_file = "temp";
     HttpRequest *req_ptr = req.get();
-    std::ofstream outfile(temp_file, std::ios::out);
-    outfile.write(req_ptr->bodyData(), req_ptr->bodyLength());
-    outfile.close();
-
-    std::ifstream in_ctxt_stream;
-
     vector<helib::Ctxt> ctxts;
-    in_ctxt_stream.open(temp_file, std::ios::in);
-    if (in_ctxt_stream.is_open())
+
+    // Current clients send a binary ciphertext batch, older ones concatenated JSON
+    if (isCtxtBatch(req_ptr->bodyData(), req_ptr->bodyLength()))
     {
-        for (int i = 0; i < squid.num_snp_cols; i++)
+        shared_ptr<ThreadPool> pool = squid.getThreadPool(std::thread::hardware_concurrency());
+        try
+        {
+            ctxts = decodeCtxtBatch(req_ptr->bodyData(), req_ptr->bodyLength(), squid.getMeta().data->publicKey, pool.get());
+        }
+        catch (const std::exception &e)
         {
-            helib::Ctxt ctxt = helib::Ctxt::readFromJSON(in_ctxt_stream, squid.getMeta().data->publicKey);
-            ctxts.push_back(ctxt);
+            LOG_DEBUG << "Rejecting malformed ciphertext batch: " << e.what();
+            ret["result"] = "failed";
+            auto resp = HttpResponse::newHttpJsonResponse(ret);
+            callback(resp);
+            return;
         }
-        in_ctxt_stream.close();
     }
     else
+    {
+        std::string temp_file = "temp";
+        std::ofstream outfile(temp_file, std::ios::out);
+        outfile.write(req_ptr->bodyData(), req_ptr->bodyLength());
+        outfile.close();
+
+        std::ifstream in_ctxt_stream;
+        in_ctxt_stream.open(temp_file, std::ios::in);
+        if (in_ctxt_stream.is_open())
+        {
+            for (int i = 0; i < squid.num_snp_cols; i++)
+            {
+                helib::Ctxt ctxt = helib::Ctxt::readFromJSON(in_ctxt_stream, squid.getMeta().data->publicKey);
+                ctxts.push_back(ctxt);
+            }
+            in_ctxt_stream.close();
+        }
+    }
+
+    if (ctxts.size() != squid.num_snp_cols)
     {
         ret["result"] = "failed";
         auto resp = HttpResponse::newHttpJsonResponse(ret);
@@ -421,7 +555,7 @@ void Server::similarityQueryAPI(const HttpRequestPtr &req,
         return;
     }
 
-    pair<helib::Ctxt, helib::Ctxt> result = squid.similarityQuery(std::stoi(binaryPheno), ctxts, std::stoi(threshold));
+    pair<helib::Ctxt, helib::Ctxt> result = squid.executeSimilarityQuery(std::stoi(binaryPheno), ctxts, std::stoi(threshold));
     
     auto ksk = key_switch_store.at(apikey);
     result.first.PublicKeySwitch(std::make_pair(std::ref(ksk.first), std::ref(ksk.second)));
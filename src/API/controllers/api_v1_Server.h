@@ -24,6 +24,7 @@ class Server : public drogon::HttpController<Server>
     METHOD_ADD(Server::printDB,"/printDB?key={1}", Get);
     METHOD_ADD(Server::authorizeAPI,"/au?key={1}", Post);
     METHOD_ADD(Server::countingQueryAPI,"/countingQuery?query={1}&conj={2}&key={3}", Get);
+    METHOD_ADD(Server::batchCountingQueryAPI,"/batchCountingQuery?queries={1}&conj={2}&key={3}", Get);
     METHOD_ADD(Server::mafQueryAPI,"/mafQuery?query={1}&conj={2}&target={3}&key={4}", Get);
     METHOD_ADD(Server::PRSQueryAPI,"/PRSQuery?params={1}&key={2}", Get);
     METHOD_ADD(Server::similarityQueryAPI,"/simQuery?threshold={1}&binaryPheno={2}&key={3}", Post);
@@ -50,6 +51,11 @@ class Server : public drogon::HttpController<Server>
                  std::string query,
                  std::string conj,
                  const std::string &apikey) const;
+    void batchCountingQueryAPI(const HttpRequestPtr &req,
+                 std::function<void (const HttpResponsePtr &)> &&callback,
+                 std::string queries,
+                 std::string conj,
+                 const std::string &apikey) const;
     void mafQueryAPI(const HttpRequestPtr &req,
                  std::function<void (const HttpResponsePtr &)> &&callback,
                  std::string query,
@@ -5,6 +5,8 @@
 #include "globals.hpp"
 
 #include "databases/FHE_disk_database.hpp"
+#include "databases/key_store.hpp"
+#include "databases/ctxt_codec.hpp"
 
 #include <curl/curl.h>
 #include <string>
@@ -23,10 +25,12 @@ std::string SEC_KEY_FILE = "sec_key";
 std::string PUBLIC_KEY_FILE = "pub_key";
 std::string OWNER_PUBLIC_KEY_FILE = "owner_pub_key";
 std::string CONFIG_FILE = "config";
+std::string KEY_STORE_FILE = "keystore";
 std::string GET_CONTEXT_API_CALL = "getcontext";
 std::string POST_AUTH_API_CALL = "au";
 
 std::string GET_COUNT_API_CALL = "countingQuery";
+std::string GET_BATCH_COUNT_API_CALL = "batchCountingQuery";
 std::string GET_MAF_API_CALL = "mafQuery";
 std::string GET_PRS_API_CALL = "PRSQuery";
 std::string GET_HEADERS_API_CALL = "headers";
@@ -92,6 +96,8 @@ std::string postHttpRequest(const std::string &url, const std::string &data)
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     // Specify the POST data
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
+    // Binary bodies contain zero bytes, so the length is given explicitly
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)data.size());
     // Set the callback function to handle the response
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
@@ -137,6 +143,109 @@ string conjunctiveToString(string conjunctive)
   return conjunctive;
 }
 
+// The JSON files are what gets exchanged with the server. Locally they are mirrored into a
+// binary key store, which later commands map instead of parsing the JSON again.
+bool keyStoreIsCurrent(KeyStore &store)
+{
+  std::string store_path = API_DATA_DIR + "/" + KEY_STORE_FILE;
+  if (!store.open(store_path))
+  {
+    return false;
+  }
+
+  std::string json_files[KeyStore::NUM_SECTIONS] = {CONTEXT_FILE, PUBLIC_KEY_FILE, SEC_KEY_FILE};
+  for (int s = 0; s < KeyStore::NUM_SECTIONS; s++)
+  {
+    std::string json_path = API_DATA_DIR + "/" + json_files[s];
+    if (std::filesystem::exists(json_path) &&
+        (!store.has(KeyStore::Section(s)) || std::filesystem::last_write_time(json_path) > std::filesystem::last_write_time(store_path)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void openKeyStore(KeyStore &store)
+{
+  if (keyStoreIsCurrent(store))
+  {
+    return;
+  }
+  store.close();
+
+  std::ifstream in_context_file(API_DATA_DIR + "/" + CONTEXT_FILE, std::ios::in);
+  if (!in_context_file.is_open())
+  {
+    return;
+  }
+  helib::Context context = helib::Context::readFromJSON(in_context_file);
+  in_context_file.close();
+
+  std::unique_ptr<helib::PubKey> pubkey;
+  std::ifstream in_pubkey_file(API_DATA_DIR + "/" + PUBLIC_KEY_FILE, std::ios::in);
+  if (in_pubkey_file.is_open())
+  {
+    pubkey = std::make_unique<helib::PubKey>(helib::PubKey::readFromJSON(in_pubkey_file, context));
+  }
+
+  std::unique_ptr<helib::SecKey> secret_key;
+  std::ifstream in_sec_key_file(API_DATA_DIR + "/" + SEC_KEY_FILE, std::ios::in);
+  if (in_sec_key_file.is_open())
+  {
+    secret_key = std::make_unique<helib::SecKey>(helib::SecKey::readFromJSON(in_sec_key_file, context));
+  }
+
+  // A read-only data directory only costs the speedup, the JSON files are read instead
+  try
+  {
+    KeyStore::write(API_DATA_DIR + "/" + KEY_STORE_FILE, context, pubkey.get(), secret_key.get());
+    store.open(API_DATA_DIR + "/" + KEY_STORE_FILE);
+  }
+  catch (const std::runtime_error &e)
+  {
+    std::cout << e.what() << std::endl;
+  }
+}
+
+helib::Context loadContext(const KeyStore &store)
+{
+  if (store.has(KeyStore::CONTEXT))
+  {
+    return store.readContext();
+  }
+  std::ifstream in_context_file(API_DATA_DIR + "/" + CONTEXT_FILE, std::ios::in);
+  return helib::Context::readFromJSON(in_context_file);
+}
+
+helib::PubKey loadPubKey(const KeyStore &store, const helib::Context &context)
+{
+  if (store.has(KeyStore::PUBLIC_KEY))
+  {
+    return store.readPubKey(context);
+  }
+  std::ifstream in_pubkey_file(API_DATA_DIR + "/" + PUBLIC_KEY_FILE, std::ios::in);
+  if (!in_pubkey_file.is_open())
+  {
+    throw "No public key file";
+  }
+  return helib::PubKey::readFromJSON(in_pubkey_file, context);
+}
+
+helib::SecKey loadSecKey(const KeyStore &store, const helib::Context &context)
+{
+  if (store.has(KeyStore::SECRET_KEY))
+  {
+    return store.readSecKey(context);
+  }
+  std::ifstream in_sec_key_file(API_DATA_DIR + "/" + SEC_KEY_FILE, std::ios::in);
+  if (!in_sec_key_file.is_open())
+  {
+    throw "No secret key file";
+  }
+  return helib::SecKey::readFromJSON(in_sec_key_file, context);
+}
+
 helib::PubKey readPubKey()
 {
   std::string context_file_path = API_DATA_DIR + "/" + CONTEXT_FILE;
@@ -146,22 +255,16 @@ helib::PubKey readPubKey()
     std::cout << "No public key file, run genKeys" << endl;
     throw "No public key file";
   }
-  std::ifstream in_context_file;
-
-  in_context_file.open(context_file_path, std::ios::in);
-  const helib::Context &context = helib::Context::readFromJSON(in_context_file);
-  in_context_file.close();
+  KeyStore store;
+  openKeyStore(store);
+  const helib::Context &context = loadContext(store);
 
   getTime();
   std::cout << "Loaded in public key" << std::endl;
 
-  std::ifstream in_pubkey_file;
-  in_pubkey_file.open(API_DATA_DIR + "/" + PUBLIC_KEY_FILE, std::ios::in);
-  if (in_pubkey_file.is_open())
+  if (std::filesystem::exists(API_DATA_DIR + "/" + PUBLIC_KEY_FILE))
   {
-    helib::PubKey pubkey = helib::PubKey::readFromJSON(in_pubkey_file, context);
-    in_pubkey_file.close();
-    return pubkey;
+    return loadPubKey(store, context);
   }
   else
   {
@@ -179,11 +282,9 @@ helib::PubKey readOwnerPubKey()
     std::cout << "No owner public key file, run getOwnerPublicKey" << endl;
     throw "No owner public key file";
   }
-  std::ifstream in_context_file;
-
-  in_context_file.open(context_file_path, std::ios::in);
-  const helib::Context &context = helib::Context::readFromJSON(in_context_file);
-  in_context_file.close();
+  KeyStore store;
+  openKeyStore(store);
+  const helib::Context &context = loadContext(store);
 
   std::ifstream in_pubkey_file;
   in_pubkey_file.open(API_DATA_DIR + "/" + OWNER_PUBLIC_KEY_FILE, std::ios::in);
@@ -220,6 +321,20 @@ void decryptAndPrintCount(vector<long> &results, long chunking_factor)
   std::cout << "Count: " << count << std::endl;
 }
 
+void decryptAndPrintBatchCount(vector<long> &results, uint32_t num_queries, long chunking_factor)
+{
+  long stride = max(chunking_factor, 1L);
+  for (uint32_t q = 0; q < num_queries; q++)
+  {
+    uint32_t count = 0;
+    for (long i = 0; i < stride; i++)
+    {
+      count += results[q * stride + i];
+    }
+    std::cout << "Count " << q << ": " << count << std::endl;
+  }
+}
+
 void decryptAndPrintMAF(vector<long> &results, long chunking_factor)
 {
   uint32_t numerator = 0;
@@ -292,31 +407,19 @@ void decrypt(std::string ctxt_file_path)
     std::cout << "No context file, run getContext" << endl;
     throw "No context file";
   }
-  std::ifstream in_context_file;
-
-  in_context_file.open(context_file_path, std::ios::in);
-  const helib::Context &context = helib::Context::readFromJSON(in_context_file);
-  in_context_file.close();
+  KeyStore store;
+  openKeyStore(store);
+  const helib::Context &context = loadContext(store);
 
   uint32_t num_slots = context.getEA().size();
 
-  std::ifstream in_sec_key_file;
-  in_sec_key_file.open(API_DATA_DIR + "/" + SEC_KEY_FILE, std::ios::in);
-  if (in_sec_key_file.is_open())
+  if (std::filesystem::exists(API_DATA_DIR + "/" + SEC_KEY_FILE))
   {
-    const helib::SecKey &secret_key = helib::SecKey::readFromJSON(in_sec_key_file, context);
-    in_sec_key_file.close();
+    const helib::SecKey &secret_key = loadSecKey(store, context);
 
     helib::Ptxt<helib::BGV> new_plaintext_result(context);
 
-    std::ifstream in_pubkey_file;
-    in_pubkey_file.open(API_DATA_DIR + "/" + PUBLIC_KEY_FILE, std::ios::in);
-    if (!in_pubkey_file.is_open())
-    {
-      throw "No public key file";
-    }
-    helib::PubKey pubkey = helib::PubKey::readFromJSON(in_pubkey_file, context);
-    in_pubkey_file.close();
+    helib::PubKey pubkey = loadPubKey(store, context);
 
     std::ifstream in_ctxt_file;
     in_ctxt_file.open(ctxt_file_path, std::ios::in);
@@ -340,6 +443,26 @@ void decrypt(std::string ctxt_file_path)
       long chunking_factor = ctxt.nAggregates;
       decryptAndPrintCount(result, chunking_factor);
     }
+    else if (queryType == "BatchCount")
+    {
+      uint32_t num_queries = 0;
+      in_ctxt_file >> num_queries;
+
+      helib::Ctxt ctxt = helib::Ctxt::readFromJSON(in_ctxt_file, pubkey);
+      secret_key.Decrypt(new_plaintext_result, ctxt);
+
+      vector<helib::PolyMod> poly_mod_result = new_plaintext_result.getSlotRepr();
+
+      vector<long> result(num_slots);
+
+      for (size_t i = 0; i < num_slots; i++)
+      {
+        result[i] = static_cast<long>(poly_mod_result[i]);
+      }
+
+      long chunking_factor = ctxt.nAggregates;
+      decryptAndPrintBatchCount(result, num_queries, chunking_factor);
+    }
     else if (queryType == "MAF")
     {
       helib::Ctxt ctxt = helib::Ctxt::readFromJSON(in_ctxt_file, pubkey);
@@ -563,11 +686,9 @@ int genKeys()
     std::cout << "No context file, run getContext" << endl;
     return 1;
   }
-  std::ifstream in_context_file;
-
-  in_context_file.open(context_file_path, std::ios::in);
-  const helib::Context &context = helib::Context::readFromJSON(in_context_file);
-  in_context_file.close();
+  KeyStore store;
+  openKeyStore(store);
+  const helib::Context &context = loadContext(store);
 
   getTime();
   std::cout << "Loaded in context" << std::endl;
@@ -608,6 +729,15 @@ int genKeys()
   }
   getTime();
   std::cout << "Wrote Public Key to File" << std::endl;
+
+  try
+  {
+    KeyStore::write(API_DATA_DIR + "/" + KEY_STORE_FILE, context, &public_key, &secret_key);
+  }
+  catch (const std::runtime_error &e)
+  {
+    std::cout << e.what() << std::endl;
+  }
   return 0;
 }
 
@@ -675,6 +805,41 @@ int countingQuery(std::string filter, std::string conjunctive)
   std::cout << "Count query result saved to count_query.results" << std::endl;
   return 0;
 }
+int batchCountingQuery(std::string filters, std::string conjunctives)
+{
+  auto conf = readConfig(API_DATA_DIR + "/" + CONFIG_FILE);
+  string API_URL = conf.first;
+  string API_KEY = conf.second;
+
+  getTime();
+  std::cout << "Batch Counting Query with:" << endl;
+  getTime();
+  std::cout << "filters: " << filters << endl;
+  getTime();
+  std::cout << "conjunctives: " << conjunctives << endl;
+
+  std::string url_request = API_URL + GET_BATCH_COUNT_API_CALL + "?queries=" + filters + "&conj=" + conjunctives + "&key=" + API_KEY;
+  std::string responseStr = sendHttpRequest(url_request);
+  json responseJson = json::parse(responseStr);
+
+  if (responseJson["result"] == "failed" || !responseJson.contains("num_queries"))
+  {
+    std::cout << "Get Batch Count API called failed" << endl;
+    return 1;
+  }
+
+  std::string context_data = responseJson["result"];
+  std::ofstream outfile("batch_count_query.results");
+  outfile << "BatchCount\n";
+  outfile << responseJson["num_queries"];
+  outfile << "\n";
+  outfile << context_data;
+  outfile.close();
+
+  getTime();
+  std::cout << "Batch count query result saved to batch_count_query.results" << std::endl;
+  return 0;
+}
 int MAFQuery(std::string filter, std::string conjunctive, std::string target_snp)
 {
   auto conf = readConfig(API_DATA_DIR + "/" + CONFIG_FILE);
@@ -822,11 +987,9 @@ int similarityQuery(std::string target_patient, std::string threshold, std::stri
     std::cout << "No context file, run getContext" << endl;
     throw "No context file";
   }
-  std::ifstream in_context_file;
-
-  in_context_file.open(context_file_path, std::ios::in);
-  const helib::Context &context = helib::Context::readFromJSON(in_context_file);
-  in_context_file.close();
+  KeyStore store;
+  openKeyStore(store);
+  const helib::Context &context = loadContext(store);
 
   getTime();
   std::cout << "Loaded in context" << std::endl;
@@ -839,7 +1002,7 @@ int similarityQuery(std::string target_patient, std::string threshold, std::stri
   getTime();
   std::cout << "Loaded in owner's public key" << std::endl;
 
-  std::string ctxts;
+  std::vector<helib::Ctxt> target_ctxts;
 
   for (size_t i = 0; i < target_patient_vector.size(); i++)
   {
@@ -851,10 +1014,9 @@ int similarityQuery(std::string target_patient, std::string threshold, std::stri
 
     helib::Ctxt ctxt(owner_pubkey);
     owner_pubkey.Encrypt(ctxt, ptxt);
-    std::stringstream ss;
-    ctxt.writeToJSON(ss);
-    ctxts += ss.str();
+    target_ctxts.push_back(ctxt);
   }
+  std::string ctxts = encodeCtxtBatch(target_ctxts);
 
   std::string url_request = API_URL + GET_SIMILARITY_API_CALL + "?threshold=" + threshold + "&binaryPheno=" + binary_phenotype_column_index + "&key=" + API_KEY;
   std::string responseStr = postHttpRequest(url_request, ctxts);
@@ -982,6 +1144,15 @@ int main(int argc, char **argv)
     }
     return countingQuery(argv[2], argv[3]);
   }
+  else if (option == "batchCount")
+  {
+    if (argc != 4)
+    {
+      std::cout << "Not enough parameters for the batch count query [filters] [conjunctives], ex: ../bin/squid batchCount \"[[(1,1)],[(0,2),(1,0)]]\" \"[1,0]\"" << std::endl;
+      return 1;
+    }
+    return batchCountingQuery(argv[2], argv[3]);
+  }
   else if (option == "MAF")
   {
     if (argc != 5)
@@ -336,6 +336,7 @@ static void BM_InsertRow(benchmark::State &state)
     for (auto _ : state)
     {
         dbFHEInstance->insertOneRow(vals);
+        dbFHEInstance->flushInserts();
     }
 }
 static void BM_DeleteRowAddition(benchmark::State &state)
@@ -404,6 +405,44 @@ static void BM_SimilarityComputation(benchmark::State &state)
     }
 }
 
+static void BM_ExtractModP(benchmark::State &state)
+{
+    // Slots of SmallFastComp have degree 3, the Large slots never need an extraction
+    Params param(constants::SmallFastComp);
+
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                                .m(param.m)
+                                .p(param.p)
+                                .r(param.r)
+                                .bits(param.qbits)
+                                .build();
+
+    helib::SecKey secret_key(context);
+    secret_key.GenSecKey();
+    helib::addFrbMatrices(secret_key);
+
+    long d = context.getOrdP();
+    he_cmp::Comparator comparator(context, he_cmp::UNI, d, 1, secret_key, false);
+
+    helib::Ptxt<helib::BGV> ptxt(context);
+    for (long i = 0; i < ptxt.size(); i++)
+    {
+        ptxt[i] = i % param.p;
+    }
+    helib::Ctxt ctxt(secret_key);
+    secret_key.Encrypt(ctxt, ptxt);
+
+    bool hoisted = state.range(0);
+
+    for (auto _ : state)
+    {
+        vector<helib::Ctxt> digits;
+        comparator.extract_mod_p(digits, ctxt, hoisted);
+        benchmark::DoNotOptimize(digits);
+    }
+    state.counters["Frobenius maps"] = d - 1;
+}
+
 BENCHMARK(BM_GeneratePublicKeySwitch)
    ->ArgsProduct({benchmark::CreateDenseRange(2, 20, 1)})
     ->Unit(benchmark::kSecond);
@@ -417,6 +456,9 @@ BENCHMARK(BM_ParallelCountQuery)->ArgsProduct({{2,4,8,16}, {1,2,4,8,16}})->Unit(
 BENCHMARK(BM_ParallelPRSQuery)->ArgsProduct({{1024, 4096, 16384}, benchmark::CreateRange(1, 16, /*step=*/2)})->Unit(benchmark::kSecond)->Setup(DoSetup);
 BENCHMARK(BM_ParallelSimilarityQuery)->ArgsProduct({{1024, 4096, 16384}, {1,2,4,8,16}})->Unit(benchmark::kSecond)->Setup(DoSetup);
 
+// 0 = one key switch per Frobenius map, 1 = hoisted
+BENCHMARK(BM_ExtractModP)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
 //BENCHMARK(BM_EncrpytCiphertext)->Unit(benchmark::kSecond)->Setup(DoSetup);
 //BENCHMARK(BM_UpdateOneValue)->ArgsProduct({benchmark::CreateRange(1, 1024, /*step=*/2)})->Unit(benchmark::kSecond)->Setup(DoSetup);
 //BENCHMARK(BM_UpdateOneRow)->ArgsProduct({benchmark::CreateRange(1, 1024, /*step=*/2)})->Unit(benchmark::kSecond)->Setup(DoSetup);
@@ -10,6 +10,7 @@ struct Config {
     int row = -1;
     int columns = -1;
     int threads = 1;
+    bool indicators = false;
     std::string vcf_file;
     std::string csv_file;
 };
@@ -23,6 +24,7 @@ void print_help() {
     std::cout << "  --threads <int>     Specify number of threads (default: 1)\n";
     std::cout << "  --vcf <filepath>    Specify path to a VCF file\n";
     std::cout << "  --csv <filepath>    Specify path to a CSV file\n";
+    std::cout << "  --indicators        Also store g==0/1/2 indicator columns for faster filters\n";
     std::cout << "  --help              Display this help message\n";
     std::cout << "\nRequirements:\n";
     std::cout << "  - Either both --vcf and --csv must be provided, or both --rows and --columns.\n";
@@ -42,6 +44,8 @@ bool parse_arguments(int argc, char* argv[], Config& config) {
             config.columns = std::stoi(argv[++i]);
         } else if (arg == "--threads" && i + 1 < argc) {
             config.threads = std::stoi(argv[++i]);
+        } else if (arg == "--indicators") {
+            config.indicators = true;
         } else if (arg == "--vcf" && i + 1 < argc) {
             config.vcf_file = argv[++i];
         } else if (arg == "--csv" && i + 1 < argc) {
@@ -84,6 +88,7 @@ int main(int argc, char* argv[]) {
     // Initialize the database
     FHEDiskDatabase *dbFHEInstance = new FHEDiskDatabase(constants::Large, false);
     dbFHEInstance->setNumThreadsEncryption(config.threads);
+    dbFHEInstance->setIndicatorColumns(config.indicators);
     if (config.row != -1) {
         // Generate synthetic data
         vector<vector<int32_t>> db;
@@ -6,45 +6,179 @@ using namespace std;
 // Modify Operations
 void FHESIMDDatabase::updateOneValue(uint32_t row, uint32_t col, uint32_t value)
 {
-    helib::Ptxt<helib::BGV> ptxt(meta.data->context);
+    updateMany(vector<CellUpdate>{{row, col, value}});
+}
 
-    uint32_t compressed_row_index = floor(row / num_slots);
-    uint32_t row_index = row - (compressed_row_index * num_slots);
+void FHESIMDDatabase::updateMany(const vector<CellUpdate> &updates)
+{
+    // Slot deltas per (column, compressed row), summed mod p
+    map<pair<uint32_t, uint32_t>, vector<unsigned long>> groups;
+    for (const CellUpdate &update : updates)
+    {
+        // Slots past num_rows must stay zero, flushInserts adds the staged rows onto them
+        uint32_t compressed_row_index = update.row / num_slots;
+        if (update.column >= num_snp_cols || update.row >= num_rows)
+        {
+            throw invalid_argument("ERROR: update of row " + to_string(update.row) + " column " + to_string(update.column) + " is out of bounds");
+        }
+        vector<unsigned long> &slots = groups[{update.column, compressed_row_index}];
+        if (slots.empty())
+        {
+            slots.resize(num_slots, 0);
+        }
+        uint32_t row_index = update.row - (compressed_row_index * num_slots);
+        slots[row_index] = (slots[row_index] + update.delta) % plaintext_modulus;
+    }
+
+    vector<pair<pair<uint32_t, uint32_t>, vector<unsigned long>>> touched(groups.begin(), groups.end());
 
-    ptxt[row_index] = value;
+    // Touched ciphertexts are independent of each other
+    getThreadPool(encryptionThreads())->parallelFor(0, touched.size(), [&](size_t i)
+                                                    {
+        uint32_t column = touched[i].first.first;
+        uint32_t compressed_row_index = touched[i].first.second;
 
-    helib::Ctxt ctxt(meta.data->publicKey);
+        helib::Ptxt<helib::BGV> ptxt(meta.data->context);
+        for (uint32_t k = 0; k < num_slots; k++)
+        {
+            ptxt[k] = touched[i].second[k];
+        }
 
-    meta.data->publicKey.Encrypt(ctxt, ptxt);
+        // A fresh encryption of zero from the pool keeps the update re-randomized without encrypting here
+        helib::Ctxt delta = zero_pool->take();
+        delta += ptxt;
 
-    snp_data[col][compressed_row_index] += ctxt;
+        helib::Ctxt genotype = getGenotype(column, compressed_row_index);
+        genotype += delta;
+        setGenotype(genotype, column, compressed_row_index); });
 }
+
 void FHESIMDDatabase::updateOneRow(uint32_t row, vector<uint32_t> &vals)
 {
+    vector<CellUpdate> updates = vector<CellUpdate>();
     for (uint32_t v = 0; v < vals.size(); v++)
     {
-        updateOneValue(row, v, vals[v]);
+        updates.push_back({row, v, vals[v]});
     }
+    updateMany(updates);
 }
 void FHESIMDDatabase::insertOneRow(vector<uint32_t> &vals)
 {
-    uint32_t new_row = num_rows + 1;
-    for (uint32_t v = 0; v < vals.size(); v++)
+    if (vals.size() != num_snp_cols)
     {
-        updateOneValue(new_row, v, vals[v]);
+        throw invalid_argument("ERROR: an inserted row needs one genotype per SNP column");
     }
+    staged_rows.push_back(vector<int32_t>(vals.begin(), vals.end()));
 }
-void FHESIMDDatabase::deleteRowAddition(uint32_t row)
+
+void FHESIMDDatabase::storeGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index)
+{
+    snp_data[column][compressed_row_index] = ctxt;
+}
+
+void FHESIMDDatabase::growCompressedRows(uint32_t num_rows)
+{
+    for (uint32_t c = 0; c < num_snp_cols; c++)
+    {
+        snp_data[c].resize(num_rows, helib::Ctxt(meta.data->publicKey));
+        if (indicator_data_set)
+        {
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                indicator_data[c][v].resize(num_rows, helib::Ctxt(meta.data->publicKey));
+            }
+        }
+    }
+    for (auto &column : binary_phenotype_data)
+    {
+        while (column.size() < num_rows)
+        {
+            column.push_back(zero_pool->take());
+        }
+    }
+    for (auto &column : continuous_phenotype_data)
+    {
+        while (column.size() < num_rows)
+        {
+            column.push_back(zero_pool->take());
+        }
+    }
+}
+
+void FHESIMDDatabase::flushInserts()
 {
-    for (uint32_t v = 0; v < num_snp_cols; v++)
+    if (staged_rows.empty())
     {
-        updateOneValue(row, v, 0);
+        return;
     }
+
+    uint32_t first_row = num_rows;
+    uint32_t new_num_rows = num_rows + staged_rows.size();
+    uint32_t new_num_compressed_rows = new_num_rows % num_slots == 0 ? new_num_rows / num_slots : (new_num_rows / num_slots) + 1;
+    uint32_t first_block = first_row / num_slots;
+    uint32_t num_blocks = new_num_compressed_rows - first_block;
+    uint32_t old_num_compressed_rows = num_compressed_rows;
+
+    growCompressedRows(new_num_compressed_rows);
+
+    // One task per touched (column, compressed row). Slots past the old last row are zero
+    // (updateMany rejects rows past num_rows), so the staged values are added onto the
+    // partially filled compressed row.
+    getThreadPool(encryptionThreads())->parallelFor(0, num_snp_cols * num_blocks, [&](size_t task)
+                                                    {
+        uint32_t c = task / num_blocks;
+        uint32_t j = first_block + task % num_blocks;
+        uint32_t begin = max(first_row, j * num_slots);
+        uint32_t end = min(new_num_rows, (j + 1) * num_slots);
+
+        helib::Ptxt<helib::BGV> ptxt(meta.data->context);
+        vector<helib::Ptxt<helib::BGV>> indicator_ptxts = vector<helib::Ptxt<helib::BGV>>(3, helib::Ptxt<helib::BGV>(meta.data->context));
+        for (uint32_t r = begin; r < end; r++)
+        {
+            int32_t genotype = staged_rows[r - first_row][c];
+            ptxt[r - j * num_slots] = genotype;
+            if (genotype >= 0 && genotype <= 2)
+            {
+                indicator_ptxts[genotype][r - j * num_slots] = 1;
+            }
+        }
+
+        helib::Ctxt ctxt = zero_pool->take();
+        ctxt += ptxt;
+        if (j < old_num_compressed_rows)
+        {
+            ctxt += *viewGenotype(c, j);
+        }
+        storeGenotype(ctxt, c, j);
+
+        if (indicator_data_set)
+        {
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                helib::Ctxt indicator = zero_pool->take();
+                indicator += indicator_ptxts[v];
+                if (j < old_num_compressed_rows)
+                {
+                    indicator += *viewIndicator(c, v, j);
+                }
+                setIndicator(indicator, c, v, j);
+            }
+        } });
+
+    num_rows = new_num_rows;
+    num_compressed_rows = new_num_compressed_rows;
+    staged_rows.clear();
+}
+void FHESIMDDatabase::deleteRowAddition(uint32_t row)
+{
+    vector<uint32_t> zeros = vector<uint32_t>(num_snp_cols, 0);
+    updateOneRow(row, zeros);
 }
 
 void FHESIMDDatabase::setGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index)
 {
     snp_data[column][compressed_row_index] = ctxt;
+    refreshIndicators(column, compressed_row_index);
 }
 
 void FHESIMDDatabase::deleteRowMultiplication(uint32_t row)
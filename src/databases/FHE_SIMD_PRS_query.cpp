@@ -3,156 +3,125 @@
 
 using namespace std;
 
-vector<helib::Ctxt> FHESIMDDatabase::PRSQuery(vector<pair<uint32_t, int32_t>> &prs_params) const
+vector<pair<uint32_t, int32_t>> FHESIMDDatabase::sortPRSParams(const vector<pair<uint32_t, int32_t>> &prs_params) const
 {
-    vector<helib::Ctxt> scores;
-
-    for (uint32_t j = 0; j < num_compressed_rows; j++)
+    // Weights that agree mod p end up in the same run
+    vector<pair<uint32_t, int32_t>> sorted_params = vector<pair<uint32_t, int32_t>>();
+    sorted_params.reserve(prs_params.size());
+    for (const pair<uint32_t, int32_t> &param : prs_params)
     {
-        helib::Ctxt sum(meta.data->publicKey);
-
-        for (pair<uint32_t, int32_t> i : prs_params)
+        int64_t weight = param.second % (int64_t)plaintext_modulus;
+        if (weight < 0)
         {
-            helib::Ctxt temp = getGenotype(i.first, j);
-            temp.multByConstant(NTL::ZZX(i.second));
-
-            sum += temp;
+            weight += plaintext_modulus;
         }
-        scores.push_back(sum);
+        sorted_params.push_back(pair(param.first, (int32_t)weight));
     }
-    return scores;
-}
 
-void process_iteration_prs(FHESIMDDatabase* db,
-                           std::vector<helib::Ctxt> &scores,
-                           vector<pair<uint32_t, int32_t>> &prs_params,
-                           size_t start_idx,
-                           size_t end_idx,
-                            std::mutex &scores_mutex
-                           )
-{
-    helib::Ctxt score = db->getGenotype(prs_params[start_idx].first, 0);
-    score.multByConstant(NTL::ZZX(prs_params[start_idx].second));
-
-    for (size_t i = start_idx + 1; i < end_idx; i++)
-    {
-        pair<uint32_t, int32_t> param = prs_params[i];
-        helib::Ctxt clone = db->getGenotype(param.first, 0);
-        clone.multByConstant(NTL::ZZX(param.second));
-        score += clone;
-    }  
-
-    std::lock_guard<std::mutex> lock(scores_mutex);
-    scores.push_back(score);
+    stable_sort(sorted_params.begin(), sorted_params.end(), [](const pair<uint32_t, int32_t> &a, const pair<uint32_t, int32_t> &b)
+                { return a.second < b.second; });
+    return sorted_params;
 }
 
-helib::Ctxt FHESIMDDatabase::PRSQueryP(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads)
+void FHESIMDDatabase::accumulatePRS(helib::Ctxt &sum, const vector<pair<uint32_t, int32_t>> &sorted_params, size_t begin, size_t end, uint32_t row) const
 {
-    uint32_t t = num_threads; // You can set this value based on the number of available cores or your requirements
-
-    size_t chunk_size = prs_params.size() / t;
-
-    std::vector<std::thread> threads;
-
-    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
-    scores.reserve(t);
-
-    std::mutex scores_mutex;
-
-
-    for (size_t i = 0; i < t; i++)
+    size_t i = begin;
+    while (i < end)
     {
-        size_t start_idx = i * chunk_size;
-        size_t end_idx = (i == t - 1) ? prs_params.size() : (i + 1) * chunk_size;
-
-        if (start_idx >= end_idx)
+        int32_t weight = sorted_params[i].second;
+        if (weight == 0)
         {
+            i++;
+            continue;
+        }
+        if (weight == 1)
+        {
+            for (; i < end && sorted_params[i].second == 1; i++)
+            {
+                sum += *viewGenotype(sorted_params[i].first, row);
+            }
             continue;
         }
 
-        threads.emplace_back(process_iteration_prs, this,
-                             std::ref(scores), std::ref(prs_params),
-                             start_idx, end_idx, std::ref(scores_mutex));
+        // Sum the genotypes of one run, then a single scalar multiply for the run
+        helib::Ctxt run = *viewGenotype(sorted_params[i].first, row);
+        for (i++; i < end && sorted_params[i].second == weight; i++)
+        {
+            run += *viewGenotype(sorted_params[i].first, row);
+        }
+        run.multByConstant(NTL::ZZ(weight));
+        sum += run;
     }
+}
 
-    for (auto &thread : threads)
-    {
-        thread.join();
-    }
+vector<helib::Ctxt> FHESIMDDatabase::PRSQuery(vector<pair<uint32_t, int32_t>> &prs_params) const
+{
+    vector<pair<uint32_t, int32_t>> sorted_params = sortPRSParams(prs_params);
+    vector<helib::Ctxt> scores;
 
-    helib::Ctxt scores_all = scores[0];
-    for (size_t i = 1; i < t; i++)
+    for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
-        scores_all += scores[i];
+        helib::Ctxt sum(meta.data->publicKey);
+        accumulatePRS(sum, sorted_params, 0, sorted_params.size(), j);
+        scores.push_back(sum);
     }
-    return scores_all;
+    return scores;
 }
 
-void process_iteration_prs_pp(FHESIMDDatabase* db,
+void process_iteration_prs(const FHESIMDDatabase *db,
                            std::vector<helib::Ctxt> &scores,
-                           vector<pair<uint32_t, int32_t>> &prs_params,
-                           size_t start_idx,
-                           size_t end_idx,
-                           std::mutex &scores_mutex
-                           )
+                           vector<pair<uint32_t, int32_t>> &sorted_params,
+                           size_t row,
+                           size_t block,
+                           size_t block_size)
 {
-    for (size_t i = start_idx; i < end_idx; i++)
-    {
+    size_t start_idx = block * block_size;
+    size_t end_idx = min(sorted_params.size(), start_idx + block_size);
 
-        helib::Ctxt sum(db->getMeta().data->publicKey);
-
-        for (size_t j = 0; j < prs_params.size(); j++)
-        {
-            helib::Ctxt temp = db->getGenotype(prs_params[j].first, i);
-            temp.multByConstant(NTL::ZZX(prs_params[j].second));
-            sum += temp;
-        }
-        
-        {
-            std::unique_lock<std::mutex> lock(scores_mutex);
-            scores.push_back(sum);
-            lock.unlock();
-        } // The lock is released here when the block ends
-    }  
+    db->accumulatePRS(scores[block], sorted_params, start_idx, end_idx, row);
 }
 
-vector<helib::Ctxt> FHESIMDDatabase::PRSQueryPP(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads)
+helib::Ctxt FHESIMDDatabase::PRSQueryP(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads)
 {
-    uint32_t t = num_threads; // You can set this value based on the number of available cores or your requirements
-
-    if (num_compressed_rows < t)
+    if (prs_params.size() == 0)
     {
-        t = num_compressed_rows;
+        throw invalid_argument("ERROR: PRS query needs at least one SNP");
     }
 
-    size_t chunk_size = num_compressed_rows / t;
+    vector<pair<uint32_t, int32_t>> sorted_params = sortPRSParams(prs_params);
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
 
-    std::vector<std::thread> threads;
-    std::vector<helib::Ctxt> scores;
+    // A few blocks per thread so that faster threads steal the remainder
+    size_t num_blocks = min(sorted_params.size(), (size_t)4 * pool->concurrency());
+    size_t block_size = (sorted_params.size() + num_blocks - 1) / num_blocks;
+    shared_ptr<void> read_ahead = readAhead(prsAddresses(sorted_params, 1));
 
-    scores.reserve(num_compressed_rows);
+    vector<helib::Ctxt> scores = vector<helib::Ctxt>(num_blocks, helib::Ctxt(meta.data->publicKey));
+    pool->parallelFor(0, num_blocks, [&](size_t block)
+                      { process_iteration_prs(this, scores, sorted_params, 0, block, block_size); });
 
-    std::mutex scores_mutex;
+    return addManyParallel(scores, meta.data->publicKey, *pool);
+}
 
-    for (size_t i = 0; i < t; i++)
-    {
-        size_t start_idx = i * chunk_size;
-        size_t end_idx = (i == t - 1) ? num_compressed_rows : (i + 1) * chunk_size;
+void process_iteration_prs_pp(const FHESIMDDatabase *db,
+                              std::vector<helib::Ctxt> &scores,
+                              vector<pair<uint32_t, int32_t>> &sorted_params,
+                              size_t row)
+{
+    db->accumulatePRS(scores[row], sorted_params, 0, sorted_params.size(), row);
+}
 
-        if (start_idx >= end_idx)
-        {
-            continue;
-        }
+vector<helib::Ctxt> FHESIMDDatabase::PRSQueryPP(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads)
+{
+    vector<pair<uint32_t, int32_t>> sorted_params = sortPRSParams(prs_params);
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
 
-        threads.emplace_back(process_iteration_prs_pp, this,
-                             std::ref(scores), std::ref(prs_params),
-                             start_idx, end_idx, std::ref(scores_mutex));
-    }
+    shared_ptr<void> read_ahead = readAhead(prsAddresses(sorted_params, num_compressed_rows));
 
-    for (auto &thread : threads)
-    {
-        thread.join();
-    }
+    // Scores stay in row order, each row is one task
+    vector<helib::Ctxt> scores = vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey));
+    pool->parallelFor(0, num_compressed_rows, [&](size_t row)
+                      { process_iteration_prs_pp(this, scores, sorted_params, row); });
 
     return scores;
 }
@@ -10,7 +10,7 @@ helib::Ctxt FHESIMDDatabase::countQuery(bool conjunctive, vector<pair<uint32_t,
         throw invalid_argument("ERROR: DB needs to be set to run query");
     }
 
-    vector<vector<helib::Ctxt>> cols = filter(query);
+    vector<vector<helib::Ctxt>> cols = filter(query, conjunctive);
 
     uint32_t num_columns = cols[0].size();
 
@@ -57,129 +57,156 @@ helib::Ctxt FHESIMDDatabase::countQuery(bool conjunctive, vector<pair<uint32_t,
     return result;
 }
 
-void process_iteration_filter(
-                              std::vector<helib::Ctxt> &predicates,
-                              vector<pair<uint32_t, uint32_t>> &query,
-                              FHESIMDDatabase *server_instance,
-                              size_t start_idx,
-                              size_t end_idx,
-                              std::mutex &predicates_mutex)
+helib::Ctxt FHESIMDDatabase::batchCountQuery(vector<CountQuery> &queries) const
 {
-    std::vector<helib::Ctxt> equality_vectors;
-
-    for (size_t i = start_idx; i < end_idx; i++)
+    if (queries.size() == 0)
     {
-        pair<uint32_t, uint32_t> column = query[i];
-        equality_vectors.push_back(server_instance->EQTest(column.second, server_instance->getGenotype(column.first, 0)));
+        throw invalid_argument("ERROR: Batch needs at least one query");
     }
-    helib::Ctxt predicate = multiplyMany(equality_vectors);
 
-    std::lock_guard<std::mutex> lock(predicates_mutex);
-    predicates.push_back(predicate);
-}
-
-helib::Ctxt FHESIMDDatabase::countQueryP(vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads)
-{
-    uint32_t t = num_threads; // You can set this value based on the number of available cores or your requirements
-
-    size_t chunk_size = query.size() / t;
-
-    std::vector<std::thread> threads;
-
-    std::mutex predicates_mutex;
-
-    vector<helib::Ctxt> predicates = vector<helib::Ctxt>();
-    predicates.reserve(t);
+    vector<helib::Ctxt> results;
+    uint32_t stride = 1;
+    for (uint32_t i = 0; i < queries.size(); i++)
+    {
+        helib::Ctxt result = executeCountQuery(queries[i].conjunctive, queries[i].filter);
+#if !COMPRESSED
+        result = squashCtxtLogTime(result);
+#endif
+        stride = max(stride, (uint32_t)(result.nAggregates > 0 ? result.nAggregates : 1));
+        results.push_back(result);
+    }
 
-    for (size_t i = 0; i < t; i++)
+    if ((uint64_t)stride * queries.size() > num_slots)
     {
-        size_t start_idx = i * chunk_size;
-        size_t end_idx = (i == t - 1) ? query.size() : (i + 1) * chunk_size;
+        throw invalid_argument("ERROR: Batch does not fit into one ciphertext, split it into smaller batches");
+    }
 
-        if (start_idx >= end_idx)
+    // Only the aggregated prefix of each result is meaningful, the other slots hold partial sums
+    const helib::EncryptedArray &ea = meta.data->context.getEA();
+    map<uint32_t, pair<helib::DoubleCRT, double>> prefix_masks;
+    for (uint32_t i = 0; i < results.size(); i++)
+    {
+        uint32_t width = results[i].nAggregates > 0 ? results[i].nAggregates : 1;
+        auto it = prefix_masks.find(width);
+        if (it == prefix_masks.end())
         {
-            continue;
+            vector<long> prefix(num_slots, 0);
+            fill(prefix.begin(), prefix.begin() + width, 1);
+            double size;
+            helib::DoubleCRT mask = encodeMask(prefix, size);
+            it = prefix_masks.emplace(width, make_pair(mask, size)).first;
+        }
+        results[i].multByConstant(it->second.first, it->second.second);
+        if (i != 0)
+        {
+            ea.rotate(results[i], i * stride);
         }
-
-        threads.emplace_back(process_iteration_filter,
-                             std::ref(predicates), std::ref(query), this,
-                             start_idx, end_idx, std::ref(predicates_mutex));
     }
 
-    for (auto &thread : threads)
-    {
-        thread.join();
-    }
-    
-    helib::Ctxt predicate = multiplyMany(predicates);
-    return squashCtxtLogTime(predicate);
+    helib::Ctxt packed = addManySafe(results, meta.data->publicKey);
+    packed.nAggregates = stride;
+
+    return packed;
 }
 
-void process_iteration_count_PP(
-                              std::vector<helib::Ctxt> &counts,
-                              vector<pair<uint32_t, uint32_t>> &query,
-                              FHESIMDDatabase *server_instance,
-                              size_t start_idx,
-                              size_t end_idx,
-                              std::mutex &counts_mutex)
+void process_iteration_filter(
+                              vector<vector<helib::Ctxt>> &partial,
+                              vector<ColumnPredicate> &compiled_query,
+                              bool conjunctive,
+                              const FHESIMDDatabase *server_instance,
+                              size_t row,
+                              size_t block,
+                              size_t block_size)
 {
-    helib::Ctxt count(server_instance->getMeta().data->publicKey);
+    size_t start_idx = block * block_size;
+    size_t end_idx = min(compiled_query.size(), start_idx + block_size);
+
+    std::vector<helib::Ctxt> equality_vectors;
     for (size_t i = start_idx; i < end_idx; i++)
     {
-        std::vector<helib::Ctxt> equality_vectors;
+        vector<helib::Ctxt> column_results = server_instance->evaluateColumnPredicate(compiled_query[i], row);
+        equality_vectors.insert(equality_vectors.end(), column_results.begin(), column_results.end());
+    }
 
-        for (size_t j = 0; j < query.size(); j++)
+    // x OR y = NOT(NOT x AND NOT y), the final negation happens once per row
+    if (!conjunctive)
+    {
+        for (helib::Ctxt &equality_vector : equality_vectors)
         {
-            pair<uint32_t, uint32_t> column = query[j];
-            equality_vectors.push_back(server_instance->EQTest(column.second, server_instance->getGenotype(column.first, i)));
+            addOneMod2(equality_vector);
         }
-        helib::Ctxt temp = multiplyMany(equality_vectors);
-        count += temp;
     }
-
-    std::lock_guard<std::mutex> lock(counts_mutex);
-    counts.push_back(count);
+    partial[row][block] = multiplyMany(equality_vectors);
 }
 
-helib::Ctxt FHESIMDDatabase::countQueryPP(vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads)
+vector<helib::Ctxt> FHESIMDDatabase::evaluateFilterRows(vector<ColumnPredicate> &compiled_query, bool conjunctive, uint32_t num_rows, const QueryPlan &plan, ThreadPool &pool) const
 {
-    uint32_t t = num_threads; // You can set this value based on the number of available cores or your requirements
-
-    if (num_compressed_rows < t)
-    {
-        t = num_compressed_rows;
-    }
-    
-    size_t chunk_size = num_compressed_rows / t;
-
-    std::vector<std::thread> threads;
+    size_t num_columns = compiled_query.size();
+    size_t block_size = (num_columns + max(plan.column_blocks, 1u) - 1) / max(plan.column_blocks, 1u);
+    size_t column_blocks = (num_columns + block_size - 1) / block_size;
 
-    std::mutex counts_mutex;
+    shared_ptr<void> read_ahead = readAhead(filterAddresses(compiled_query, num_rows));
 
-    vector<helib::Ctxt> counts = vector<helib::Ctxt>();
-    counts.reserve(t);
+    // Every task writes its own slot, nothing is shared between tasks
+    vector<vector<helib::Ctxt>> partial(num_rows, vector<helib::Ctxt>(column_blocks, helib::Ctxt(meta.data->publicKey)));
+    pool.parallelFor(0, num_rows * column_blocks, [&](size_t task)
+                     { process_iteration_filter(partial, compiled_query, conjunctive, this, task / column_blocks, task % column_blocks, block_size); });
 
-    for (size_t i = 0; i < t; i++)
+    vector<helib::Ctxt> predicates = vector<helib::Ctxt>();
+    if (num_rows == 1)
     {
-        size_t start_idx = i * chunk_size;
-        size_t end_idx = (i == t - 1) ? num_compressed_rows : (i + 1) * chunk_size;
+        predicates.push_back(multiplyManyParallel(partial[0], pool));
+    }
+    else
+    {
+        predicates = vector<helib::Ctxt>(num_rows, helib::Ctxt(meta.data->publicKey));
+        pool.parallelFor(0, num_rows, [&](size_t row)
+                         { predicates[row] = multiplyMany(partial[row]); });
+    }
 
-        if (start_idx >= end_idx)
+    if (!conjunctive)
+    {
+        for (helib::Ctxt &predicate : predicates)
         {
-            continue;
+            addOneMod2(predicate);
         }
-
-        threads.emplace_back(process_iteration_count_PP,
-                             std::ref(counts), std::ref(query), this,
-                             start_idx, end_idx, std::ref(counts_mutex));
     }
+    return predicates;
+}
 
-    for (auto &thread : threads)
+shared_ptr<ThreadPool> FHESIMDDatabase::getThreadPool(uint32_t num_threads) const
+{
     {
-        thread.join();
+        std::lock_guard<std::mutex> lock(thread_pool_mutex);
+        if (!thread_pool)
+        {
+            uint32_t hardware_threads = max(1u, std::thread::hardware_concurrency());
+            thread_pool = make_shared<ThreadPool>(hardware_threads - 1);
+        }
     }
+    // Callers asking for different thread counts share the workers, only their parallelism differs
+    return thread_pool->limited(num_threads);
+}
 
-    helib::Ctxt count = addManySafe(counts, meta.data->publicKey);
-    return squashCtxtLogTime(count);
+helib::Ctxt FHESIMDDatabase::countQueryP(vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads)
+{
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
+
+    vector<ColumnPredicate> compiled_query = compileQuery(query, true);
+    QueryPlan plan = {num_threads, (uint32_t)compiled_query.size(), false};
+    vector<helib::Ctxt> predicates = evaluateFilterRows(compiled_query, true, 1, plan, *pool);
+
+    return squashCtxtLogTime(predicates[0]);
 }
 
+helib::Ctxt FHESIMDDatabase::countQueryPP(vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads)
+{
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
+
+    vector<ColumnPredicate> compiled_query = compileQuery(query, true);
+    QueryPlan plan = {num_threads, (uint32_t)compiled_query.size(), false};
+    vector<helib::Ctxt> counts = evaluateFilterRows(compiled_query, true, num_compressed_rows, plan, *pool);
+
+    helib::Ctxt count = addManyParallel(counts, meta.data->publicKey, *pool);
+    return squashCtxtLogTime(count);
+}
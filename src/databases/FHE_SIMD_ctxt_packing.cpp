@@ -39,35 +39,25 @@ helib::Ctxt FHESIMDDatabase::squashCtxtLogTimePower2(helib::Ctxt &ciphertext) co
 
 helib::Ctxt FHESIMDDatabase::squashCtxtLogTime(helib::Ctxt &ciphertext) const
 {
+    if (squash_kernel == SquashKernel::Hoisted && hoistable_squash)
+    {
+        return squashCtxtHoisted(ciphertext);
+    }
+
     const helib::EncryptedArray &ea = meta.data->context.getEA();
 
     uint32_t depth = floor(log2(num_slots));
 
-    helib::Ptxt<helib::BGV> mask(meta.data->context);
-    helib::Ptxt<helib::BGV> inverse_mask(meta.data->context);
-
     int32_t chunkingFactor = getChunkingFactor();
 
     uint32_t largest_power_of_two_less_than_or_equal_two_slotsize = 1 << depth;
-    for (uint32_t i = 0; i < num_slots; i++)
-    {
-        if (i < largest_power_of_two_less_than_or_equal_two_slotsize)
-        {
-            mask[i] = 1;
-            inverse_mask[i] = 0;
-        }
-        else
-        {
-            mask[i] = 0;
-            inverse_mask[i] = 1;
-        }
-    }
+
     helib::Ctxt far_end = ciphertext;
-    far_end.multByConstant(inverse_mask);
+    far_end.multByConstant(squash_masks[1], squash_mask_sizes[1]);
 
     ea.rotate(far_end, -largest_power_of_two_less_than_or_equal_two_slotsize);
 
-    ciphertext.multByConstant(mask);
+    ciphertext.multByConstant(squash_masks[0], squash_mask_sizes[0]);
     ciphertext += far_end;
 
     uint32_t level = 0;
@@ -91,6 +81,108 @@ helib::Ctxt FHESIMDDatabase::squashCtxtLogTime(helib::Ctxt &ciphertext) const
     return ciphertext;
 }
 
+helib::Ctxt FHESIMDDatabase::squashCtxtHoisted(helib::Ctxt &ciphertext) const
+{
+    if (!hoistable_squash)
+    {
+        throw invalid_argument("ERROR: Hoisted squash requires every hypercube dimension to be native");
+    }
+
+    const helib::EncryptedArray &ea = meta.data->context.getEA();
+
+    // Same overflow bound as squashCtxtLogTime: at most 2^(chunkingFactor + 2) slots summed into one
+    int32_t chunkingFactor = getChunkingFactor();
+    uint64_t merge_limit = chunkingFactor < 0 ? UINT64_MAX : (uint64_t(1) << (chunkingFactor + 2));
+    uint64_t merged = 1;
+
+    // Dimensions are reduced from the most significant one, so the partial sums
+    // always sit in a prefix of the slots and nAggregates keeps its meaning
+    long trailing = num_slots;
+    for (long dim = 0; dim < ea.dimension(); dim++)
+    {
+        long size = ea.sizeOfDimension(dim);
+        trailing /= size;
+        long width = 1L << (long)floor(log2(size));
+
+        if (width != size)
+        {
+            if (merged * 2 > merge_limit)
+            {
+                ciphertext.nAggregates = size * trailing;
+                return ciphertext;
+            }
+            helib::Ctxt far_end = ciphertext;
+            far_end.multByConstant(dimension_fold_masks[dim], dimension_fold_mask_sizes[dim]);
+            ea.rotate1D(far_end, dim, -width);
+            ciphertext += far_end;
+            merged *= 2;
+
+            if (ciphertext.bitCapacity() < EARLY_TERM_NOISE_THRES)
+            {
+                ciphertext.nAggregates = width * trailing;
+                return ciphertext;
+            }
+        }
+
+        while (width > 1)
+        {
+            long levels = min((long)SQUASH_HOIST_LEVELS, (long)log2(width));
+            while (levels > 0 && (merged << levels) > merge_limit)
+            {
+                levels--;
+            }
+            if (levels == 0)
+            {
+                ciphertext.nAggregates = width * trailing;
+                return ciphertext;
+            }
+
+            // 2^levels - 1 rotations of the same ciphertext share its digit decomposition
+            long step = width >> levels;
+            ciphertext.cleanUp();
+            helib::BasicAutomorphPrecon precon(ciphertext);
+            helib::Ctxt sum = ciphertext;
+            for (long k = 1; k < (1L << levels); k++)
+            {
+                addRotation1D(sum, precon, ciphertext, dim, size - k * step);
+            }
+            sum.cleanUp();
+            ciphertext = sum;
+
+            width = step;
+            merged <<= levels;
+
+            if (ciphertext.bitCapacity() < EARLY_TERM_NOISE_THRES)
+            {
+                ciphertext.nAggregates = width * trailing;
+                return ciphertext;
+            }
+        }
+    }
+
+    ciphertext.nAggregates = 1;
+    return ciphertext;
+}
+
+void FHESIMDDatabase::addRotation1D(helib::Ctxt &sum, const helib::BasicAutomorphPrecon &precon, const helib::Ctxt &ciphertext, long dim, long amount) const
+{
+    const helib::EncryptedArray &ea = meta.data->context.getEA();
+    long automorphism = ea.getPAlgebra().genToPow(dim, amount);
+    long key_id = ciphertext.getKeyID();
+
+    if (ciphertext.getPubKey().haveKeySWmatrix(1, automorphism, key_id, key_id))
+    {
+        sum += *precon.automorph(automorphism);
+    }
+    else
+    {
+        // Keys saved before addSquashMatrices only carry the 1D baby-step/giant-step matrices
+        helib::Ctxt rotated = ciphertext;
+        ea.rotate1D(rotated, dim, amount);
+        sum += rotated;
+    }
+}
+
 helib::Ctxt FHESIMDDatabase::squashCtxtWithMask(helib::Ctxt &ciphertext, uint32_t index) const
 {
     ciphertext = squashCtxtLogTime(ciphertext);
@@ -100,13 +192,84 @@ helib::Ctxt FHESIMDDatabase::squashCtxtWithMask(helib::Ctxt &ciphertext, uint32_
     {
         ea.rotate(ciphertext, index);
     }
-    helib::Ptxt<helib::BGV> mask(meta.data->context);
-    mask[index] = 1;
-    ciphertext.multByConstant(mask);
+    double size;
+    const helib::DoubleCRT &mask = getSlotMask(index, size);
+    ciphertext.multByConstant(mask, size);
 
     return ciphertext;
 }
 
+void FHESIMDDatabase::initSquashMasks()
+{
+    const helib::EncryptedArray &ea = meta.data->context.getEA();
+    const helib::PAlgebra &zMStar = meta.data->context.getZMStar();
+
+    uint32_t depth = floor(log2(num_slots));
+    uint32_t largest_power_of_two_less_than_or_equal_two_slotsize = 1 << depth;
+
+    vector<long> mask(num_slots, 0);
+    vector<long> inverse_mask(num_slots, 0);
+    for (uint32_t i = 0; i < num_slots; i++)
+    {
+        if (i < largest_power_of_two_less_than_or_equal_two_slotsize)
+        {
+            mask[i] = 1;
+        }
+        else
+        {
+            inverse_mask[i] = 1;
+        }
+    }
+
+    squash_masks = vector<helib::DoubleCRT>();
+    squash_mask_sizes = vector<double>(2);
+    squash_masks.push_back(encodeMask(mask, squash_mask_sizes[0]));
+    squash_masks.push_back(encodeMask(inverse_mask, squash_mask_sizes[1]));
+
+    hoistable_squash = true;
+    dimension_fold_masks = vector<helib::DoubleCRT>();
+    dimension_fold_mask_sizes = vector<double>(ea.dimension());
+    for (long dim = 0; dim < ea.dimension(); dim++)
+    {
+        hoistable_squash = hoistable_squash && ea.nativeDimension(dim);
+
+        long width = 1L << (long)floor(log2(ea.sizeOfDimension(dim)));
+        vector<long> fold_mask(num_slots, 0);
+        for (uint32_t i = 0; i < num_slots; i++)
+        {
+            fold_mask[i] = zMStar.coordinate(dim, i) >= width;
+        }
+        dimension_fold_masks.push_back(encodeMask(fold_mask, dimension_fold_mask_sizes[dim]));
+    }
+}
+
+helib::DoubleCRT FHESIMDDatabase::encodeMask(const vector<long> &slots, double &size) const
+{
+    NTL::ZZX mask_zzx;
+    meta.data->context.getEA().encode(mask_zzx, slots);
+    size = NTL::conv<double>(helib::embeddingLargestCoeff(mask_zzx, meta.data->context.getZMStar()));
+    return helib::DoubleCRT(mask_zzx, meta.data->context, meta.data->context.allPrimes());
+}
+
+const helib::DoubleCRT &FHESIMDDatabase::getSlotMask(uint32_t index, double &size) const
+{
+    if (index >= num_slots)
+    {
+        throw invalid_argument("ERROR: Slot mask index out of bounds");
+    }
+
+    std::lock_guard<std::mutex> lock(slot_masks_mutex);
+    auto it = slot_masks.find(index);
+    if (it == slot_masks.end())
+    {
+        vector<long> one_hot(num_slots, 0);
+        one_hot[index] = 1;
+        it = slot_masks.emplace(index, encodeMask(one_hot, slot_mask_sizes[index])).first;
+    }
+    size = slot_mask_sizes[index];
+    return it->second;
+}
+
 void FHESIMDDatabase::ctxtExpand(helib::Ctxt &ciphertext) const
 {
     const helib::EncryptedArray &ea = meta.data->context.getEA();
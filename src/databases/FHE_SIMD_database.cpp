@@ -41,6 +41,8 @@ void FHESIMDDatabase::initialize(const Params &_params, bool _with_similarity)
 
     snp_data_set = false;
 
+    initSquashMasks();
+
     with_comparator = _with_similarity;
 
     if (with_comparator)
@@ -48,7 +50,7 @@ void FHESIMDDatabase::initialize(const Params &_params, bool _with_similarity)
         comparator = std::make_unique<he_cmp::Comparator>(meta.data->context, he_cmp::UNI, _params.d, _params.l, meta.data->secretKey, false);
     }
 
-    encryptZero = new helib::Ctxt(meta.data->publicKey);
+    zero_pool = std::make_unique<ZeroEncryptionPool>(meta.data->publicKey);
 }
 
 helib::Ctxt FHESIMDDatabase::getGenotype(uint32_t column, uint32_t row) const
@@ -78,11 +80,36 @@ helib::Ctxt FHESIMDDatabase::getBinaryPheno(uint32_t column, uint32_t row) const
     return binary_phenotype_data[column][row];
 }
 
-helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, helib::Ctxt b) const
+CtxtHandle FHESIMDDatabase::viewGenotype(uint32_t column, uint32_t row) const
+{
+    if (column >= num_snp_cols || row >= num_compressed_rows || !snp_data_set)
+    {
+        throw invalid_argument("ERROR: Trying to access out of bounds SNP data or SNP data not set");
+    }
+    return CtxtHandle(snp_data[column][row]);
+}
+
+CtxtHandle FHESIMDDatabase::viewContinuousPheno(uint32_t column, uint32_t row) const
+{
+    if (column >= num_continuous_pheno_cols || row >= num_compressed_rows || !continuous_phenotype_data_set)
+    {
+        throw invalid_argument("ERROR: Trying to access out of bounds continuous phenotype data or continuous phenotype data not set");
+    }
+    return CtxtHandle(continuous_phenotype_data[column][row]);
+}
+
+CtxtHandle FHESIMDDatabase::viewBinaryPheno(uint32_t column, uint32_t row) const
 {
-    helib::Ctxt clone = b;
-    DynamicCtxtPowers babyStep(clone, 3);
+    if (column >= num_binary_pheno_cols || row >= num_compressed_rows || !binary_phenotype_data_set)
+    {
+        throw invalid_argument("ERROR: Trying to access out of bounds binary phenotype data or binary phenotype data not set");
+    }
+    return CtxtHandle(binary_phenotype_data[column][row]);
+}
 
+NTL::ZZX FHESIMDDatabase::equalityPolynomial(unsigned long a) const
+{
+    NTL::ZZX poly;
     switch (a)
     {
     case 0:
@@ -93,15 +120,12 @@ helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, helib::Ctxt b) const
         //  1 -> 0
         //  2 -> 0
 
-        NTL::ZZX poly;
         NTL::SetCoeff(poly, 3, one_over_two);
         NTL::SetCoeff(poly, 2, neg_one);
         NTL::SetCoeff(poly, 1, neg_one_over_two);
         NTL::SetCoeff(poly, 0, 1);
 
-        simplePolyEval(clone, poly, babyStep);
-
-        return clone;
+        return poly;
     }
     case 1:
     {
@@ -110,14 +134,11 @@ helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, helib::Ctxt b) const
         //  0 -> 0
         //  1 -> 1
         //  2 -> 0
-        NTL::ZZX poly;
         NTL::SetCoeff(poly, 3, neg_one_over_two);
         NTL::SetCoeff(poly, 2, one_over_two);
         NTL::SetCoeff(poly, 1, 1);
 
-        simplePolyEval(clone, poly, babyStep);
-
-        return clone;
+        return poly;
     }
     case 2:
     {
@@ -127,13 +148,10 @@ helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, helib::Ctxt b) const
         //  1 -> 0
         //  2 -> 1
 
-        NTL::ZZX poly;
         NTL::SetCoeff(poly, 3, one_over_six);
         NTL::SetCoeff(poly, 1, neg_one_over_six);
 
-        simplePolyEval(clone, poly, babyStep);
-
-        return clone;
+        return poly;
     }
     default:
         cout << "Can't use a value of a other than 0, 1, or 2" << endl;
@@ -141,24 +159,254 @@ helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, helib::Ctxt b) const
     }
 }
 
-vector<vector<helib::Ctxt>> FHESIMDDatabase::filter(vector<pair<uint32_t, uint32_t>> &query) const
+NTL::ZZX FHESIMDDatabase::membershipPolynomial(const vector<uint32_t> &values) const
+{
+    // The equality polynomials are indicators over {-1, 0, 1, 2}, so "x in S" is just their sum
+    NTL::ZZX poly;
+    for (uint32_t value : values)
+    {
+        poly += equalityPolynomial(value);
+    }
+    return poly;
+}
+
+helib::Ctxt FHESIMDDatabase::EQTest(unsigned long a, const helib::Ctxt &b) const
+{
+    // The power table holds the only copy of b
+    DynamicCtxtPowers babyStep(b, 3);
+
+    helib::Ctxt result(b.getPubKey());
+    simplePolyEval(result, equalityPolynomial(a), babyStep);
+
+    return result;
+}
+
+vector<ColumnPredicate> FHESIMDDatabase::compileQuery(const vector<pair<uint32_t, uint32_t>> &query, bool conjunctive) const
+{
+    // Group the filters by column (keeping first-seen order) and drop duplicates
+    vector<ColumnPredicate> compiled = vector<ColumnPredicate>();
+    map<uint32_t, size_t> column_index;
+    vector<vector<uint32_t>> column_values;
+
+    for (const pair<uint32_t, uint32_t> &filter : query)
+    {
+        auto it = column_index.find(filter.first);
+        if (it == column_index.end())
+        {
+            it = column_index.emplace(filter.first, compiled.size()).first;
+            compiled.push_back(ColumnPredicate{filter.first, vector<vector<uint32_t>>()});
+            column_values.push_back(vector<uint32_t>());
+        }
+
+        vector<uint32_t> &values = column_values[it->second];
+        if (find(values.begin(), values.end(), filter.second) == values.end())
+        {
+            values.push_back(filter.second);
+        }
+    }
+
+    for (size_t i = 0; i < compiled.size(); i++)
+    {
+        if (conjunctive)
+        {
+            // Every value stays its own factor of the final product
+            for (uint32_t value : column_values[i])
+            {
+                compiled[i].value_sets.push_back(vector<uint32_t>{value});
+            }
+        }
+        else
+        {
+            // OR over one column collapses into a single set-membership test
+            compiled[i].value_sets.push_back(column_values[i]);
+        }
+    }
+    return compiled;
+}
+
+bool FHESIMDDatabase::usesIndicators(const ColumnPredicate &predicate) const
+{
+    bool use_indicators = indicator_data_set;
+    for (const vector<uint32_t> &values : predicate.value_sets)
+    {
+        for (uint32_t value : values)
+        {
+            use_indicators = use_indicators && value <= 2;
+        }
+    }
+    return use_indicators;
+}
+
+vector<helib::Ctxt> FHESIMDDatabase::evaluateColumnPredicate(const ColumnPredicate &predicate, uint32_t row) const
+{
+    vector<helib::Ctxt> results = vector<helib::Ctxt>();
+
+    if (usesIndicators(predicate))
+    {
+        for (const vector<uint32_t> &values : predicate.value_sets)
+        {
+            helib::Ctxt result = getIndicator(predicate.column, values[0], row);
+            for (size_t i = 1; i < values.size(); i++)
+            {
+                result += *viewIndicator(predicate.column, values[i], row);
+            }
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    // x, x^2 and x^3 are computed once and shared by every polynomial on this column
+    DynamicCtxtPowers powers(*viewGenotype(predicate.column, row), 3);
+    for (const vector<uint32_t> &values : predicate.value_sets)
+    {
+        helib::Ctxt result(meta.data->publicKey);
+        simplePolyEval(result, membershipPolynomial(values), powers);
+        results.push_back(result);
+    }
+    return results;
+}
+
+vector<CtxtAddress> FHESIMDDatabase::filterAddresses(const vector<ColumnPredicate> &compiled_query, uint32_t num_rows) const
+{
+    vector<CtxtAddress> addresses = vector<CtxtAddress>();
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        for (const ColumnPredicate &predicate : compiled_query)
+        {
+            if (!usesIndicators(predicate))
+            {
+                addresses.push_back({CtxtAddress::GENOTYPE, predicate.column, row, 0});
+                continue;
+            }
+            for (const vector<uint32_t> &values : predicate.value_sets)
+            {
+                for (uint32_t value : values)
+                {
+                    addresses.push_back({CtxtAddress::INDICATOR, predicate.column, row, value});
+                }
+            }
+        }
+    }
+    return addresses;
+}
+
+vector<CtxtAddress> FHESIMDDatabase::prsAddresses(const vector<pair<uint32_t, int32_t>> &sorted_params, uint32_t num_rows) const
+{
+    vector<CtxtAddress> addresses = vector<CtxtAddress>();
+    for (uint32_t row = 0; row < num_rows; row++)
+    {
+        for (const pair<uint32_t, int32_t> &param : sorted_params)
+        {
+            // accumulatePRS never reads zero-weight SNPs
+            if (param.second != 0)
+            {
+                addresses.push_back({CtxtAddress::GENOTYPE, param.first, row, 0});
+            }
+        }
+    }
+    return addresses;
+}
+
+vector<helib::Ctxt> FHESIMDDatabase::evaluatePredicates(const vector<ColumnPredicate> &predicates, uint32_t row) const
+{
+    vector<helib::Ctxt> results = vector<helib::Ctxt>();
+    for (const ColumnPredicate &predicate : predicates)
+    {
+        vector<helib::Ctxt> column_results = evaluateColumnPredicate(predicate, row);
+        results.insert(results.end(), column_results.begin(), column_results.end());
+    }
+    return results;
+}
+
+helib::Ctxt FHESIMDDatabase::getIndicator(uint32_t column, uint32_t value, uint32_t row) const
+{
+    if (column >= num_snp_cols || row >= num_compressed_rows || !indicator_data_set)
+    {
+        throw invalid_argument("ERROR: Trying to access out of bounds indicator data or indicator data not set");
+    }
+    if (value > 2)
+    {
+        throw invalid_argument("ERROR: indicator columns only exist for values 0, 1 and 2");
+    }
+    return indicator_data[column][value][row];
+}
+
+CtxtHandle FHESIMDDatabase::viewIndicator(uint32_t column, uint32_t value, uint32_t row) const
+{
+    if (column >= num_snp_cols || row >= num_compressed_rows || !indicator_data_set)
+    {
+        throw invalid_argument("ERROR: Trying to access out of bounds indicator data or indicator data not set");
+    }
+    if (value > 2)
+    {
+        throw invalid_argument("ERROR: indicator columns only exist for values 0, 1 and 2");
+    }
+    return CtxtHandle(indicator_data[column][value][row]);
+}
+
+void FHESIMDDatabase::setIndicator(helib::Ctxt ctxt, uint32_t column, uint32_t value, uint32_t compressed_row_index)
+{
+    indicator_data[column][value][compressed_row_index] = ctxt;
+}
+
+vector<helib::Ctxt> FHESIMDDatabase::encryptIndicatorBlock(const vector<int32_t> &genotypes)
+{
+    vector<helib::Ctxt> indicators = vector<helib::Ctxt>();
+    for (int32_t value = 0; value < 3; value++)
+    {
+        // Slots past the end of the block stay zero so padding never matches
+        vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
+        for (uint32_t k = 0; k < genotypes.size(); k++)
+        {
+            ptxt[k] = genotypes[k] == value ? 1 : 0;
+        }
+        indicators.push_back(encrypt(ptxt));
+    }
+    return indicators;
+}
+
+void FHESIMDDatabase::refreshIndicators(uint32_t column, uint32_t compressed_row_index)
+{
+    if (!indicator_data_set)
+    {
+        return;
+    }
+
+    // The plaintext genotype is unknown here, so rebuild the indicators homomorphically
+    CtxtHandle genotype = viewGenotype(column, compressed_row_index);
+    for (uint32_t value = 0; value < 3; value++)
+    {
+        setIndicator(EQTest(value, *genotype), column, value, compressed_row_index);
+    }
+}
+
+helib::Ctxt FHESIMDDatabase::equalityColumn(uint32_t column, uint32_t value, uint32_t row) const
+{
+    if (indicator_data_set && value <= 2)
+    {
+        return getIndicator(column, value, row);
+    }
+    return EQTest(value, *viewGenotype(column, row));
+}
+
+vector<vector<helib::Ctxt>> FHESIMDDatabase::filter(vector<pair<uint32_t, uint32_t>> &query, bool conjunctive) const
 {
     vector<vector<helib::Ctxt>> feature_cols;
+    vector<ColumnPredicate> predicates = compileQuery(query, conjunctive);
 
     for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
-        vector<helib::Ctxt> indv_vector;
-        for (pair<uint32_t, uint32_t> i : query)
-        {
-            indv_vector.push_back(EQTest(i.second, getGenotype(i.first, j)));
+        vector<helib::Ctxt> indv_vector = evaluatePredicates(predicates, j);
 
-            if (constants::DEBUG == 3)
+        if (constants::DEBUG == 3)
+        {
+            for (pair<uint32_t, uint32_t> i : query)
             {
                 cout << "checking equality to " << i.second << endl;
                 cout << "original:";
                 print_vector(decrypt(getGenotype(i.first, j)));
                 cout << "result  :";
-                print_vector(decrypt(EQTest(i.second, getGenotype(i.first, j))));
+                print_vector(decrypt(equalityColumn(i.first, i.second, j)));
             }
         }
         feature_cols.push_back(indv_vector);
@@ -219,7 +467,7 @@ helib::Ctxt FHESIMDDatabase::encryptFast(unsigned long a)
     {
         ptxt[i] = a;
     }
-    helib::Ctxt ctxt = *encryptZero;
+    helib::Ctxt ctxt = zero_pool->take();
     ctxt += ptxt;
     return ctxt;
 }
@@ -7,8 +7,14 @@
 #include <iostream>
 #include <thread>
 #include <utility>
+#include <map>
+#include <algorithm>
+#include <mutex>
 #include <helib/helib.h>
 #include "tools.hpp"
+#include "thread_pool.hpp"
+#include "vcf_reader.hpp"
+#include "zero_pool.hpp"
 #include "comparator.hpp"
 #include "../globals.hpp"
 
@@ -19,6 +25,81 @@
 
 #define COMPRESSED 1
 
+// All filters of a query that touch one SNP column. Each value set becomes one
+// predicate ciphertext that is 1 where the genotype is any of its values.
+struct ColumnPredicate
+{
+    uint32_t column;
+    vector<vector<uint32_t>> value_sets;
+};
+
+// Read-only access to a stored ciphertext without copying it. The in-memory
+// database lends a pointer into its own storage; the disk database hands over
+// the ciphertext it just read. A handle must not outlive its database.
+class CtxtHandle
+{
+public:
+    explicit CtxtHandle(const helib::Ctxt &borrowed) : ptr(&borrowed) {}
+    explicit CtxtHandle(helib::Ctxt &&ctxt) : owned(make_shared<const helib::Ctxt>(std::move(ctxt))), ptr(owned.get()) {}
+    explicit CtxtHandle(shared_ptr<const helib::Ctxt> shared) : owned(std::move(shared)), ptr(owned.get()) {}
+
+    const helib::Ctxt &operator*() const { return *ptr; }
+    const helib::Ctxt *operator->() const { return ptr; }
+
+private:
+    shared_ptr<const helib::Ctxt> owned;
+    const helib::Ctxt *ptr;
+};
+
+// A stored ciphertext a query is going to read, see readAhead. value is only used by indicators.
+struct CtxtAddress
+{
+    enum Kind
+    {
+        GENOTYPE,
+        BINARY_PHENO,
+        CONTINUOUS_PHENO,
+        INDICATOR
+    };
+    Kind kind;
+    uint32_t column;
+    uint32_t row;
+    uint32_t value;
+};
+
+// Adds delta to the genotype of one (row, column) cell, see updateMany
+struct CellUpdate
+{
+    uint32_t row;
+    uint32_t column;
+    uint32_t delta;
+};
+
+// One counting query of a batch
+struct CountQuery
+{
+    bool conjunctive;
+    vector<pair<uint32_t, uint32_t>> filter;
+};
+
+// How the executor splits a query: every compressed row is a task, and the
+// filter columns / PRS terms of a row are cut into column_blocks tasks when
+// the rows alone cannot keep num_threads busy. The final squash is a single
+// ciphertext, with ntl_squash it runs on the calling thread's NTL pool.
+struct QueryPlan
+{
+    uint32_t num_threads;
+    uint32_t column_blocks;
+    bool ntl_squash;
+};
+
+// Slot aggregation kernel used by squashCtxtLogTime
+enum class SquashKernel
+{
+    LogTime, // one key-switched linear rotation per halving step
+    Hoisted  // per hypercube dimension, SQUASH_HOIST_LEVELS halving steps share one key-switch decomposition
+};
+
 class FHESIMDDatabase : public Database<helib::Ctxt, helib::Ctxt>
 {
 public:
@@ -38,32 +119,82 @@ public:
     void setData(string vcf_file) override;
 
     void setColumnHeaders(vector<string> &headers);
+    // Threads of the loaders, 0 uses all hardware threads
+    void setNumThreadsEncryption(uint32_t threads) { num_threads_encryption = threads; }
 
     helib::Ctxt getGenotype(uint32_t column, uint32_t row) const override;
     helib::Ctxt getContinuousPheno(uint32_t column, uint32_t row) const override;
     helib::Ctxt getBinaryPheno(uint32_t column, uint32_t row) const override;
 
+    // Zero-copy variants of the getters above, for ciphertexts that are only read
+    virtual CtxtHandle viewGenotype(uint32_t column, uint32_t row) const;
+    virtual CtxtHandle viewContinuousPheno(uint32_t column, uint32_t row) const;
+    virtual CtxtHandle viewBinaryPheno(uint32_t column, uint32_t row) const;
+    virtual CtxtHandle viewIndicator(uint32_t column, uint32_t value, uint32_t row) const;
+
+    // Hint that a query reads these ciphertexts in this order. The disk database loads them
+    // ahead of the workers until the returned ticket is released, the in-memory one has nothing to do.
+    virtual shared_ptr<void> readAhead(vector<CtxtAddress>) const { return nullptr; }
+
     // Modify Operations
     void updateOneValue(uint32_t row, uint32_t col, uint32_t value);
+    // Updates are grouped per ciphertext: one plaintext add and one write back through
+    // setGenotype per touched (column, compressed row), however many cells it covers.
+    // Only rows below num_rows can be updated, staged rows are not flushed yet.
+    void updateMany(const vector<CellUpdate> &updates);
     void updateOneRow(uint32_t row, vector<uint32_t> &vals);
+    // Stages a row of num_snp_cols genotypes, nothing is encrypted until flushInserts.
+    // Queries and updates do not see staged rows, callers flush before querying them.
     void insertOneRow(vector<uint32_t> &vals);
+    // Appends the staged rows: fills the last compressed row, adds new ones as needed and encrypts
+    // every touched ciphertext once. Phenotypes of inserted rows start out as 0.
+    virtual void flushInserts();
+    size_t stagedRows() const { return staged_rows.size(); }
     void deleteRowAddition(uint32_t row);
     void deleteRowMultiplication(uint32_t row);
+    // Encryptions of zero kept ready for the DML above and encryptFast, starts refilling the pool right away
+    void setZeroPoolSize(size_t size) { zero_pool->setCapacity(size); }
 
     void setGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index) override;
 
+    // Indicator columns (g == 0, g == 1, g == 2) encrypted at ingest time
+    void setIndicatorColumns(bool enabled) { with_indicators = enabled; }
+    bool withIndicatorColumns() const { return with_indicators; }
+    virtual helib::Ctxt getIndicator(uint32_t column, uint32_t value, uint32_t row) const;
+    virtual void setIndicator(helib::Ctxt ctxt, uint32_t column, uint32_t value, uint32_t compressed_row_index);
+    vector<helib::Ctxt> encryptIndicatorBlock(const vector<int32_t> &genotypes);
+    // Encrypts the slots of compressed row compressed_row of a full plaintext column
+    helib::Ctxt encryptBlock(const vector<int32_t> &column, uint32_t compressed_row);
+    void refreshIndicators(uint32_t column, uint32_t compressed_row_index);
+
     // Querries
     helib::Ctxt countQuery(bool conjunctive, vector<pair<uint32_t, uint32_t>> &query) const override;
     helib::Ctxt countQueryP(vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads);
 
+    // Executor entry points: cover every compressed row and pick the row x column split
+    // from the query shape. num_threads == 0 uses all hardware threads.
+    QueryPlan planQuery(uint32_t num_rows, uint32_t num_columns, uint32_t num_threads) const;
+    helib::Ctxt executeCountQuery(bool conjunctive, vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads = 0) const;
+    helib::Ctxt executeMAFQuery(uint32_t snp, bool conjunctive, vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads = 0) const;
+    vector<helib::Ctxt> executePRSQuery(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads = 0) const;
+    pair<helib::Ctxt, helib::Ctxt> executeSimilarityQuery(uint32_t target_column, vector<helib::Ctxt> &d, uint32_t threshold, uint32_t num_threads = 0) const;
+    // Query i is aggregated into slots [i * nAggregates, (i + 1) * nAggregates) of one ciphertext
+    helib::Ctxt batchCountQuery(vector<CountQuery> &queries) const;
+
     helib::Ctxt MAFQuery(uint32_t snp, bool conjunctive, vector<pair<uint32_t, uint32_t>> &query) const override;
     helib::Ctxt MAFQueryP(uint32_t snp, vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads);
 
     helib::Ctxt countingRangeQuery(uint32_t lower, uint32_t upper, uint32_t phenotype_index) override;
+    // Threads used inside one comparison (range and similarity queries), 1 keeps it serial
+    void setComparisonThreads(uint32_t num_threads);
     pair<helib::Ctxt, helib::Ctxt> MAFRangeQuery(uint32_t snp, uint32_t lower, uint32_t upper, uint32_t phenotype_index) override;
 
     vector<helib::Ctxt> PRSQuery(vector<pair<uint32_t, int32_t>> &prs_params) const override;
     helib::Ctxt PRSQueryP(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads);
+    // PRS kernel: terms are sorted by weight mod p, each run of equal weights is summed
+    // first and multiplied by its weight once
+    vector<pair<uint32_t, int32_t>> sortPRSParams(const vector<pair<uint32_t, int32_t>> &prs_params) const;
+    void accumulatePRS(helib::Ctxt &sum, const vector<pair<uint32_t, int32_t>> &sorted_params, size_t begin, size_t end, uint32_t row) const;
 
     pair<helib::Ctxt, helib::Ctxt> similarityQuery(uint32_t target_column, vector<helib::Ctxt> &d, uint32_t threshold) const override;
     pair<helib::Ctxt, helib::Ctxt> similarityQueryP(uint32_t target_column, vector<helib::Ctxt> &d, uint32_t num_threshold, uint32_t threads);
@@ -79,16 +210,38 @@ public:
     helib::Ctxt squashCtxtLogTime(helib::Ctxt &ciphertext) const;
     helib::Ctxt squashCtxtLogTimePower2(helib::Ctxt &ciphertext) const;
 
+    helib::Ctxt squashCtxtHoisted(helib::Ctxt &ciphertext) const;
+    void setSquashKernel(SquashKernel kernel) { squash_kernel = kernel; }
+    SquashKernel getSquashKernel() const { return squash_kernel; }
+
     helib::Ctxt squashCtxtWithMask(helib::Ctxt &ciphertext, uint32_t index) const;
     void maskWithNumRows(vector<helib::Ctxt> &ciphertexts) const;
-    helib::Ctxt EQTest(unsigned long a, helib::Ctxt b) const;
-    vector<vector<helib::Ctxt>> filter(vector<pair<uint32_t, uint32_t>> &query) const;
+    helib::Ctxt EQTest(unsigned long a, const helib::Ctxt &b) const;
+    helib::Ctxt equalityColumn(uint32_t column, uint32_t value, uint32_t row) const;
+    NTL::ZZX equalityPolynomial(unsigned long a) const;
+    NTL::ZZX membershipPolynomial(const vector<uint32_t> &values) const;
+
+    // Query compilation: group filters per column so the power basis is shared
+    vector<ColumnPredicate> compileQuery(const vector<pair<uint32_t, uint32_t>> &query, bool conjunctive) const;
+    bool usesIndicators(const ColumnPredicate &predicate) const;
+    vector<helib::Ctxt> evaluateColumnPredicate(const ColumnPredicate &predicate, uint32_t row) const;
+    // Ciphertexts read by the filter / PRS terms for the first num_rows compressed rows, in task order
+    vector<CtxtAddress> filterAddresses(const vector<ColumnPredicate> &compiled_query, uint32_t num_rows) const;
+    vector<CtxtAddress> prsAddresses(const vector<pair<uint32_t, int32_t>> &sorted_params, uint32_t num_rows) const;
+    vector<helib::Ctxt> evaluatePredicates(const vector<ColumnPredicate> &predicates, uint32_t row) const;
+    vector<vector<helib::Ctxt>> filter(vector<pair<uint32_t, uint32_t>> &query, bool conjunctive = true) const;
+    // Filter result for each of the first num_rows compressed rows, one task per row x column block
+    vector<helib::Ctxt> evaluateFilterRows(vector<ColumnPredicate> &compiled_query, bool conjunctive, uint32_t num_rows, const QueryPlan &plan, ThreadPool &pool) const;
+
+    // Handle on the shared executor, sized to the hardware once, that runs at most num_threads tasks at a time
+    shared_ptr<ThreadPool> getThreadPool(uint32_t num_threads) const;
     void ctxtExpand(helib::Ctxt &ciphertext) const;
 
     // Encrypt / Decrypt Methods
     helib::Ptxt<helib::BGV> decryptPlaintext(helib::Ctxt ctxt);
     vector<long> decrypt(helib::Ctxt ctxt) const;
     helib::Ctxt encrypt(unsigned long a);
+    // Plaintext added to a precomputed encryption of zero
     helib::Ctxt encryptFast(unsigned long a);
     helib::Ctxt encrypt(vector<unsigned long> a);
     helib::Ctxt encryptSK(unsigned long a);
@@ -141,8 +294,48 @@ protected:
 
     uint32_t plaintext_modulus;
 
-    helib::Ctxt *encryptZero;
-    bool is_encrypt_zero_set = false;
+    // Declared after meta, it holds a reference to the public key
+    unique_ptr<ZeroEncryptionPool> zero_pool;
+
+    vector<vector<int32_t>> staged_rows;
+    // Stores a genotype ciphertext without rebuilding its indicators
+    virtual void storeGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index);
+    // Makes room for compressed rows up to num_rows, phenotypes of the new ones encrypt 0
+    virtual void growCompressedRows(uint32_t num_rows);
+
+    mutable shared_ptr<ThreadPool> thread_pool;
+    mutable std::mutex thread_pool_mutex;
+
+    SquashKernel squash_kernel = SquashKernel::LogTime;
+    bool hoistable_squash = false; // every hypercube dimension is native
+
+    // Squash masks are encoded once in initialize(), one-hot slot masks on first use
+    vector<helib::DoubleCRT> squash_masks; // [0] first 2^depth slots, [1] the rest
+    vector<double> squash_mask_sizes;
+    vector<helib::DoubleCRT> dimension_fold_masks; // per dimension, coordinates >= largest power of two
+    vector<double> dimension_fold_mask_sizes;
+    mutable map<uint32_t, helib::DoubleCRT> slot_masks;
+    mutable map<uint32_t, double> slot_mask_sizes;
+    mutable std::mutex slot_masks_mutex;
+
+    // Loaders encrypt on encryptionThreads() threads, one task per column x compressed row
+    uint32_t num_threads_encryption = 0;
+    uint32_t encryptionThreads() const;
+    // num_columns columns of num_rows values drawn uniformly from [low, high]
+    vector<vector<int32_t>> genColumns(uint32_t num_columns, int32_t low, int32_t high, uint32_t seed) const;
+    vector<vector<helib::Ctxt>> encryptColumns(const vector<vector<int32_t>> &columns);
+    // Encrypts SNP columns of num_rows genotypes and appends them to the in-memory data
+    void appendSNPColumns(const vector<vector<int32_t>> &columns);
+
+    void initSquashMasks();
+    helib::DoubleCRT encodeMask(const vector<long> &slots, double &size) const;
+    const helib::DoubleCRT &getSlotMask(uint32_t index, double &size) const;
+    void addRotation1D(helib::Ctxt &sum, const helib::BasicAutomorphPrecon &precon, const helib::Ctxt &ciphertext, long dim, long amount) const;
+
+    bool with_indicators = false;
+    bool indicator_data_set = false;
+    vector<vector<vector<helib::Ctxt>>> indicator_data; // [column][value][compressed row]
+
     vector<string> binary_pheno_headers;
     vector<string> continuous_pheno_headers;
 };
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include "FHE_SIMD_database.hpp"
+#include "tools.hpp"
+
+using namespace std;
+
+QueryPlan FHESIMDDatabase::planQuery(uint32_t num_rows, uint32_t num_columns, uint32_t num_threads) const
+{
+    QueryPlan plan;
+    plan.num_threads = num_threads > 0 ? num_threads : max(1u, thread::hardware_concurrency());
+
+    num_rows = max(num_rows, 1u);
+    num_columns = max(num_columns, 1u);
+
+    // Rows only meet again in the final sum, so they are split first. Columns are
+    // cut into blocks only when there are fewer rows than threads (wide queries).
+    plan.column_blocks = 1;
+    if (num_rows < plan.num_threads)
+    {
+        plan.column_blocks = min(num_columns, (plan.num_threads + num_rows - 1) / num_rows);
+    }
+
+    // HElib operations inside the tasks stay single-threaded, the cores are
+    // already split between tasks. The squash that follows is one ciphertext.
+    plan.ntl_squash = plan.num_threads > 1;
+
+    return plan;
+}
+
+helib::Ctxt FHESIMDDatabase::executeCountQuery(bool conjunctive, vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads) const
+{
+    if (!snp_data_set)
+    {
+        throw invalid_argument("ERROR: DB needs to be set to run query");
+    }
+
+    vector<ColumnPredicate> compiled_query = compileQuery(query, conjunctive);
+    QueryPlan plan = planQuery(num_compressed_rows, compiled_query.size(), num_threads);
+    shared_ptr<ThreadPool> pool = getThreadPool(plan.num_threads);
+
+    vector<helib::Ctxt> filter_results = evaluateFilterRows(compiled_query, conjunctive, num_compressed_rows, plan, *pool);
+    maskWithNumRows(filter_results);
+    helib::Ctxt result = addManyParallel(filter_results, meta.data->publicKey, *pool);
+
+#if COMPRESSED
+    if (plan.ntl_squash)
+    {
+        useNTLThreadPool();
+    }
+    result = squashCtxtLogTime(result);
+#endif
+
+    return result;
+}
+
+void process_iteration_MAF_execute(
+                              std::vector<helib::Ctxt> &alleles,
+                              std::vector<helib::Ctxt> &filter_results,
+                              uint32_t snp,
+                              const FHESIMDDatabase *server_instance,
+                              size_t row)
+{
+    alleles[row] = filter_results[row];
+    alleles[row] *= *server_instance->viewGenotype(snp, row);
+}
+
+helib::Ctxt FHESIMDDatabase::executeMAFQuery(uint32_t snp, bool conjunctive, vector<pair<uint32_t, uint32_t>> &query, uint32_t num_threads) const
+{
+    if (!snp_data_set)
+    {
+        throw invalid_argument("ERROR: DB needs to be set to run query");
+    }
+
+    vector<ColumnPredicate> compiled_query = compileQuery(query, conjunctive);
+    QueryPlan plan = planQuery(num_compressed_rows, compiled_query.size(), num_threads);
+    shared_ptr<ThreadPool> pool = getThreadPool(plan.num_threads);
+
+    vector<helib::Ctxt> filter_results = evaluateFilterRows(compiled_query, conjunctive, num_compressed_rows, plan, *pool);
+    maskWithNumRows(filter_results);
+
+    vector<CtxtAddress> snp_addresses = vector<CtxtAddress>();
+    for (uint32_t row = 0; row < num_compressed_rows; row++)
+    {
+        snp_addresses.push_back({CtxtAddress::GENOTYPE, snp, row, 0});
+    }
+    shared_ptr<void> read_ahead = readAhead(snp_addresses);
+
+    vector<helib::Ctxt> alleles = vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey));
+    pool->parallelFor(0, num_compressed_rows, [&](size_t row)
+                      { process_iteration_MAF_execute(alleles, filter_results, snp, this, row); });
+
+    helib::Ctxt freq = addManyParallel(alleles, meta.data->publicKey, *pool);
+    helib::Ctxt number_of_patients = addManyParallel(filter_results, meta.data->publicKey, *pool);
+
+#if COMPRESSED
+    if (plan.ntl_squash)
+    {
+        useNTLThreadPool();
+    }
+    freq = squashCtxtWithMask(freq, 0);
+    number_of_patients = squashCtxtWithMask(number_of_patients, freq.nAggregates);
+#endif
+
+    number_of_patients.multByConstant(NTL::ZZX(2));
+
+    freq += number_of_patients;
+
+    return freq;
+}
+
+void process_iteration_prs_execute(const FHESIMDDatabase *db,
+                                   vector<vector<helib::Ctxt>> &partial,
+                                   vector<pair<uint32_t, int32_t>> &sorted_params,
+                                   size_t row,
+                                   size_t block,
+                                   size_t block_size)
+{
+    size_t start_idx = block * block_size;
+    size_t end_idx = min(sorted_params.size(), start_idx + block_size);
+
+    db->accumulatePRS(partial[row][block], sorted_params, start_idx, end_idx, row);
+}
+
+vector<helib::Ctxt> FHESIMDDatabase::executePRSQuery(vector<pair<uint32_t, int32_t>> &prs_params, uint32_t num_threads) const
+{
+    if (prs_params.size() == 0)
+    {
+        throw invalid_argument("ERROR: PRS query needs at least one SNP");
+    }
+
+    vector<pair<uint32_t, int32_t>> sorted_params = sortPRSParams(prs_params);
+    QueryPlan plan = planQuery(num_compressed_rows, sorted_params.size(), num_threads);
+    shared_ptr<ThreadPool> pool = getThreadPool(plan.num_threads);
+
+    size_t block_size = (sorted_params.size() + plan.column_blocks - 1) / plan.column_blocks;
+    size_t column_blocks = (sorted_params.size() + block_size - 1) / block_size;
+    shared_ptr<void> read_ahead = readAhead(prsAddresses(sorted_params, num_compressed_rows));
+
+    vector<vector<helib::Ctxt>> partial(num_compressed_rows, vector<helib::Ctxt>(column_blocks, helib::Ctxt(meta.data->publicKey)));
+    pool->parallelFor(0, num_compressed_rows * column_blocks, [&](size_t task)
+                      { process_iteration_prs_execute(this, partial, sorted_params, task / column_blocks, task % column_blocks, block_size); });
+
+    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
+    for (uint32_t row = 0; row < num_compressed_rows; row++)
+    {
+        scores.push_back(addManyParallel(partial[row], meta.data->publicKey, *pool));
+    }
+    return scores;
+}
+
+void process_iteration_similarity_execute(const FHESIMDDatabase *db,
+                                          vector<vector<helib::Ctxt>> &partial,
+                                          vector<helib::Ctxt> &d,
+                                          size_t row,
+                                          size_t block,
+                                          size_t block_size)
+{
+    size_t start_idx = block * block_size;
+    size_t end_idx = min(d.size(), start_idx + block_size);
+
+    for (size_t i = start_idx; i < end_idx; i++)
+    {
+        helib::Ctxt clone = *db->viewGenotype(i, row);
+        clone -= d[i];
+        addSquareNoRelin(partial[row][block], clone);
+    }
+}
+
+pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::executeSimilarityQuery(uint32_t target_column, vector<helib::Ctxt> &d, uint32_t threshold, uint32_t num_threads) const
+{
+    if (!with_comparator || !binary_phenotype_data_set)
+    {
+        std::cout << "Server not setup to run similarity queries" << std::endl;
+        throw "Invalid setup";
+    }
+
+    if (num_deletes > constants::ALPHA)
+    {
+        std::cout << "Too many deletes have been performed. Cannot run similarity query" << std::endl;
+        std::cout << "The data owner needs to refresh the ciphertexts" << std::endl;
+        throw "Too many deletes";
+    }
+
+    if (d.size() == 0)
+    {
+        throw invalid_argument("ERROR: Similarity query needs a target patient");
+    }
+
+    QueryPlan plan = planQuery(num_compressed_rows, d.size(), num_threads);
+    shared_ptr<ThreadPool> pool = getThreadPool(plan.num_threads);
+
+    size_t block_size = (d.size() + plan.column_blocks - 1) / plan.column_blocks;
+    size_t column_blocks = (d.size() + block_size - 1) / block_size;
+
+    vector<vector<helib::Ctxt>> partial(num_compressed_rows, vector<helib::Ctxt>(column_blocks, helib::Ctxt(meta.data->publicKey)));
+    pool->parallelFor(0, num_compressed_rows * column_blocks, [&](size_t task)
+                      { process_iteration_similarity_execute(this, partial, d, task / column_blocks, task % column_blocks, block_size); });
+
+    helib::Ptxt<helib::BGV> ptxt_threshold(meta.data->context);
+    for (uint32_t i = 0; i < num_slots; i++)
+    {
+        ptxt_threshold[i] = threshold;
+    }
+
+    // The comparison dominates, one task per row
+    vector<helib::Ctxt> predicate = vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey));
+    vector<helib::Ctxt> inverse_target_column = vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey));
+    pool->parallelFor(0, num_compressed_rows, [&](size_t row)
+                      {
+        helib::Ctxt score = addManySafe(partial[row], meta.data->publicKey);
+        score.cleanUp();
+        comparator->compare(predicate[row], score, ptxt_threshold);
+
+        inverse_target_column[row] = getBinaryPheno(target_column, row);
+        addOneMod2(inverse_target_column[row]); });
+
+    maskWithNumRows(inverse_target_column);
+    maskWithNumRows(predicate);
+
+    pool->parallelFor(0, num_compressed_rows, [&](size_t row)
+                      {
+        inverse_target_column[row].multiplyBy(predicate[row]);
+        predicate[row].multiplyBy(*viewBinaryPheno(target_column, row)); });
+
+    helib::Ctxt count_with = addManyParallel(predicate, meta.data->publicKey, *pool);
+    helib::Ctxt count_without = addManyParallel(inverse_target_column, meta.data->publicKey, *pool);
+
+    if (plan.ntl_squash)
+    {
+        useNTLThreadPool();
+    }
+    count_with = squashCtxtLogTime(count_with);
+    count_without = squashCtxtLogTime(count_without);
+
+    return pair(count_with, count_without);
+}
@@ -3,6 +3,15 @@
 
 using namespace std;
 
+void FHESIMDDatabase::setComparisonThreads(uint32_t num_threads)
+{
+    if (!with_comparator)
+    {
+        throw invalid_argument("ERROR: DB was set up without a comparator");
+    }
+    comparator->set_thread_pool(num_threads > 1 ? getThreadPool(num_threads) : nullptr);
+}
+
 helib::Ctxt FHESIMDDatabase::countingRangeQuery(uint32_t lower, uint32_t upper, uint32_t phenotype_index)
 {
     if (!continuous_phenotype_data_set){
@@ -12,34 +21,19 @@ helib::Ctxt FHESIMDDatabase::countingRangeQuery(uint32_t lower, uint32_t upper,
         throw invalid_argument("Count range query not supported without comparator");
     }
 
-    helib::Ptxt<helib::BGV> ptxt_lower(meta.data->context);
-    helib::Ptxt<helib::BGV> ptxt_upper(meta.data->context);
-
-    for (uint32_t i = 0; i < num_slots; i++)
-    {
-        ptxt_lower[i] = lower;
-        ptxt_upper[i] = upper;
-    }
-
     vector<helib::Ctxt> predicates = vector<helib::Ctxt>();
     predicates.reserve(num_compressed_rows);
 
     for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
-        helib::Ctxt lower_predicate(meta.data->publicKey);
-        helib::Ctxt upper_predicate(meta.data->publicKey);
+        helib::Ctxt predicate(meta.data->publicKey);
 
-        helib::Ctxt phenotype = getContinuousPheno(phenotype_index,j);
+        CtxtHandle phenotype = viewContinuousPheno(phenotype_index,j);
 
-        comparator->compare(lower_predicate, phenotype, ptxt_lower);
-        comparator->compare(upper_predicate, phenotype, ptxt_upper);
+        // lower <= phenotype < upper
+        comparator->in_range(predicate, *phenotype, lower, upper);
 
-        addOneMod2(lower_predicate);
-
-        upper_predicate *= lower_predicate;
-        upper_predicate.cleanUp();
-
-        predicates.push_back(std::move(upper_predicate));
+        predicates.push_back(std::move(predicate));
     }
 
     helib::Ctxt result = addManySafe(predicates, meta.data->publicKey);
@@ -56,34 +50,19 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::MAFRangeQuery(uint32_t snp, uint
         throw invalid_argument("Count range query not supported without comparator");
     }
 
-    helib::Ptxt<helib::BGV> ptxt_lower(meta.data->context);
-    helib::Ptxt<helib::BGV> ptxt_upper(meta.data->context);
-
-    for (uint32_t i = 0; i < num_slots; i++)
-    {
-        ptxt_lower[i] = lower;
-        ptxt_upper[i] = upper;
-    }
-
     vector<helib::Ctxt> predicates = vector<helib::Ctxt>();
     predicates.reserve(num_compressed_rows);
 
     for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
-        helib::Ctxt lower_predicate(meta.data->publicKey);
-        helib::Ctxt upper_predicate(meta.data->publicKey);
-
-        helib::Ctxt phenotype = getContinuousPheno(phenotype_index,j);
-
-        comparator->compare(lower_predicate, phenotype, ptxt_lower);
-        comparator->compare(upper_predicate, phenotype, ptxt_upper);
+        helib::Ctxt predicate(meta.data->publicKey);
 
-        addOneMod2(lower_predicate);
+        CtxtHandle phenotype = viewContinuousPheno(phenotype_index,j);
 
-        upper_predicate *= lower_predicate;
-        upper_predicate.cleanUp();
+        // lower <= phenotype < upper
+        comparator->in_range(predicate, *phenotype, lower, upper);
 
-        predicates.push_back(upper_predicate);
+        predicates.push_back(predicate);
     }
 
     helib::Ctxt result = addManySafe(predicates, meta.data->publicKey);
@@ -93,8 +72,8 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::MAFRangeQuery(uint32_t snp, uint
 
     for (uint32_t i = 0; i < num_compressed_rows; i++)
     {
-        helib::Ctxt clone = getGenotype(snp,i);
-        clone *= predicates[i];
+        helib::Ctxt clone = predicates[i];
+        clone *= *viewGenotype(snp,i);
         clone.cleanUp();
         
         // Use move semantics to avoid copying the Ctxt object
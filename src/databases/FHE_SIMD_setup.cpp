@@ -8,102 +8,104 @@ void FHESIMDDatabase::genData(uint32_t num_rows, uint32_t num_snp_cols, uint32_t
     this->num_rows = num_rows;
     this->num_snp_cols = num_snp_cols;
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(0, 2);
-
     this->num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
-    
-    this->snp_data = vector<vector<helib::Ctxt>>();
-    for (uint32_t i = 0; i < num_snp_cols; i++)
-    {
-        uint32_t rows_set = 0;
-        vector<helib::Ctxt> snp_data_column = vector<helib::Ctxt>();
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = dis(gen);
-                rows_set += 1;
-            }
 
-            helib::Ctxt ctxt = encrypt(ptxt);
+    this->snp_data = vector<vector<helib::Ctxt>>();
+    this->indicator_data = vector<vector<vector<helib::Ctxt>>>();
+    appendSNPColumns(genColumns(num_snp_cols, 0, 2, seed));
 
-            snp_data_column.push_back(ctxt);
-        }
-        this->snp_data.push_back(snp_data_column);
-    }
     this->snp_data_set = true;
+    this->indicator_data_set = with_indicators;
 }
 
 void FHESIMDDatabase::genContinuousPhenoData(uint32_t num_continuous_pheno_cols, uint32_t low, uint32_t high, uint32_t seed)
 {
     this->num_continuous_pheno_cols = num_continuous_pheno_cols;
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(low, high);
+    continuous_phenotype_data = encryptColumns(genColumns(num_continuous_pheno_cols, low, high, seed));
 
-    continuous_phenotype_data = vector<vector<helib::Ctxt>>();
-    for (uint32_t i = 0; i < num_continuous_pheno_cols; i++){
-        vector<helib::Ctxt> phenotype_data_column = vector<helib::Ctxt>();
-        uint32_t rows_set = 0;
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-            helib::Ptxt<helib::BGV> ptxt(meta.data->context);
-            helib::Ctxt ctxt(meta.data->publicKey);
+    continuous_phenotype_data_set = true;
+}
 
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = dis(gen);
-                rows_set += 1;
-            }
+void FHESIMDDatabase::genBinaryPhenoData(uint32_t num_binary_pheno_cols, uint32_t seed)
+{
+    this->num_binary_pheno_cols = num_binary_pheno_cols;
 
-            meta.data->publicKey.Encrypt(ctxt, ptxt.getPolyRepr());
+    this->binary_phenotype_data = encryptColumns(genColumns(num_binary_pheno_cols, 0, 1, seed));
 
-            phenotype_data_column.push_back(ctxt);
-        }
-        continuous_phenotype_data.push_back(phenotype_data_column);
+    this->binary_phenotype_data_set = true;
+}
+
+uint32_t FHESIMDDatabase::encryptionThreads() const
+{
+    return num_threads_encryption > 0 ? num_threads_encryption : max(1u, thread::hardware_concurrency());
+}
+
+vector<vector<int32_t>> FHESIMDDatabase::genColumns(uint32_t num_columns, int32_t low, int32_t high, uint32_t seed) const
+{
+    // Each column draws from its own stream, so the values do not depend on the thread count
+    vector<vector<int32_t>> columns = vector<vector<int32_t>>(num_columns, vector<int32_t>(num_rows, 0));
+    getThreadPool(encryptionThreads())->parallelFor(0, num_columns, [&](size_t i)
+                                                    {
+        mt19937 gen = columnGenerator(seed, i);
+        uniform_int_distribution<> dis(low, high);
+        for (uint32_t k = 0; k < num_rows; k++)
+        {
+            columns[i][k] = dis(gen);
+        } });
+    return columns;
+}
+
+helib::Ctxt FHESIMDDatabase::encryptBlock(const vector<int32_t> &column, uint32_t compressed_row)
+{
+    vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
+
+    uint32_t entries_left = min(num_slots, num_rows - (compressed_row * num_slots));
+    for (uint32_t k = 0; k < entries_left; k++)
+    {
+        ptxt[k] = column[compressed_row * num_slots + k];
     }
 
-    continuous_phenotype_data_set = true;
+    return encrypt(ptxt);
 }
 
-void FHESIMDDatabase::genBinaryPhenoData(uint32_t num_binary_pheno_cols, uint32_t seed)
+vector<vector<helib::Ctxt>> FHESIMDDatabase::encryptColumns(const vector<vector<int32_t>> &columns)
 {
-    this->num_binary_pheno_cols = num_binary_pheno_cols;
+    // Preallocated, every task writes its own ciphertext
+    vector<vector<helib::Ctxt>> encrypted = vector<vector<helib::Ctxt>>(columns.size(), vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey)));
+    getThreadPool(encryptionThreads())->parallelFor(0, columns.size() * num_compressed_rows, [&](size_t task)
+                                                    {
+        uint32_t c = task / num_compressed_rows;
+        uint32_t j = task % num_compressed_rows;
+        encrypted[c][j] = encryptBlock(columns[c], j); });
+    return encrypted;
+}
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(0, 1);
+void FHESIMDDatabase::appendSNPColumns(const vector<vector<int32_t>> &columns)
+{
+    size_t first = snp_data.size();
+    snp_data.resize(first + columns.size(), vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey)));
+    if (with_indicators)
+    {
+        indicator_data.resize(first + columns.size(), vector<vector<helib::Ctxt>>(3, vector<helib::Ctxt>(num_compressed_rows, helib::Ctxt(meta.data->publicKey))));
+    }
 
-    this->binary_phenotype_data = vector<vector<helib::Ctxt>>();
-    for (uint32_t i = 0; i < num_binary_pheno_cols; i++){
-        vector<helib::Ctxt> phenotype_data_column = vector<helib::Ctxt>();
-        uint32_t rows_set = 0;
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-            helib::Ptxt<helib::BGV> ptxt(meta.data->context);
-            helib::Ctxt ctxt(meta.data->publicKey);
+    getThreadPool(encryptionThreads())->parallelFor(0, columns.size() * num_compressed_rows, [&](size_t task)
+                                                    {
+        uint32_t c = task / num_compressed_rows;
+        uint32_t j = task % num_compressed_rows;
+        snp_data[first + c][j] = encryptBlock(columns[c], j);
 
+        if (with_indicators)
+        {
             uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
+            vector<int32_t> block(columns[c].begin() + j * num_slots, columns[c].begin() + j * num_slots + entries_left);
+            vector<helib::Ctxt> indicators = encryptIndicatorBlock(block);
+            for (uint32_t v = 0; v < 3; v++)
             {
-                ptxt[k] = dis(gen);
-                rows_set += 1;
+                indicator_data[first + c][v][j] = indicators[v];
             }
-
-            meta.data->publicKey.Encrypt(ctxt, ptxt.getPolyRepr());
-
-            phenotype_data_column.push_back(ctxt);
-        }
-        this->binary_phenotype_data.push_back(phenotype_data_column);
-    }
-    this->binary_phenotype_data_set = true;
+        } });
 }
 
 void FHESIMDDatabase::setData(vector<vector<int32_t>> &db)
@@ -119,28 +121,11 @@ void FHESIMDDatabase::setData(vector<vector<int32_t>> &db)
     num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
 
     snp_data = vector<vector<helib::Ctxt>>();
-    for (uint32_t i = 0; i < num_snp_cols; i++)
-    {
-        vector<helib::Ctxt> cipher_vector = vector<helib::Ctxt>();
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = db[i][j * num_slots + k];
-            }
-
-            helib::Ctxt ctxt = encrypt(ptxt);
-
-            cipher_vector.push_back(ctxt);
-        }
-        snp_data.push_back(cipher_vector);
-    }
+    indicator_data = vector<vector<vector<helib::Ctxt>>>();
+    appendSNPColumns(db);
 
     snp_data_set = true;
+    indicator_data_set = with_indicators;
 }
 
 void FHESIMDDatabase::setBinaryPhenoData(vector<vector<int32_t>> &db)
@@ -151,105 +136,46 @@ void FHESIMDDatabase::setBinaryPhenoData(vector<vector<int32_t>> &db)
         throw invalid_argument("ERROR: DB has zero columns! THIS DOES NOT WORK!");
     }
 
-    binary_phenotype_data = vector<vector<helib::Ctxt>>();
-    for (uint32_t i = 0; i < num_binary_pheno_cols; i++)
-    {
-        vector<helib::Ctxt> pheno_column = vector<helib::Ctxt>();
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = db[i][j * num_slots + k];
-            }
-
-            helib::Ctxt ctxt = encrypt(ptxt);
-
-            pheno_column.push_back(ctxt);
-        }
-        binary_phenotype_data.push_back(pheno_column);
-    }
+    binary_phenotype_data = encryptColumns(db);
 
     binary_phenotype_data_set = true;
 }
 
 void FHESIMDDatabase::setData(string vcf_file)
 {
-    std::ifstream file(vcf_file);
-    if (!file.is_open())
+    VCFReader reader;
+    if (!reader.open(vcf_file))
     {
         std::cout << "Error opening file: " << vcf_file << std::endl;
         return;
     }
 
-    uint32_t col_counter = 0;
-    uint32_t row_counter = 0;
-    uint32_t delimiter_counter = 0;
+    // SNP lines are encrypted batch by batch as they are parsed, the plaintext matrix is never built
+    snp_data = vector<vector<helib::Ctxt>>();
+    indicator_data = vector<vector<vector<helib::Ctxt>>>();
+    num_snp_cols = 0;
 
-    std::vector<std::vector<int32_t>> matrix;
-    std::string line;
-    while (std::getline(file, line))
+    uint32_t batch_size = 2 * encryptionThreads();
+    vector<string> names = vector<string>();
+    vector<vector<int32_t>> batch = vector<vector<int32_t>>();
+    while (reader.nextBatch(batch_size, names, batch, getThreadPool(encryptionThreads()).get()) > 0)
     {
-        // Skip header lines starting with "#"
-        if (line[0] == '#')
-            continue;
-
-        std::vector<int32_t> row;
-
-        col_counter += 1;
-
-        std::istringstream iss(line);
-        std::string token;
-        while (std::getline(iss, token, '\t'))
+        if (num_snp_cols == 0)
         {
-            if (delimiter_counter == 2)
-            { // When we are reading in the snp name
-                column_headers.push_back(token);
-            }
-
-            delimiter_counter += 1;
-            if (token.find(".") != std::string::npos)
-            {
-                row.push_back(-1);
-                row_counter += 1;
-                continue;
-            }
-            if (token == "1/1" || token == "1|1")
-            {
-                row.push_back(2);
-                row_counter += 1;
-            }
-            if (token == "0/1" || token == "0|1")
-            {
-                row.push_back(1);
-                row_counter += 1;
-            }
-            if (token == "1|0")
-            {
-                row.push_back(1);
-                row_counter += 1;
-            }
-            if (token == "0/0" || token == "0|0")
-            {
-                row.push_back(0);
-                row_counter += 1;
-            }
+            num_rows = reader.numSamples();
+            num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
         }
-        num_rows = row_counter;
-        row_counter = 0;
-        delimiter_counter = 0;
-
-        matrix.push_back(row);
+        column_headers.insert(column_headers.end(), names.begin(), names.end());
+        appendSNPColumns(batch);
+        num_snp_cols += batch.size();
+    }
+    if (num_snp_cols == 0)
+    {
+        throw invalid_argument("ERROR: DB has zero columns! THIS DOES NOT WORK!");
     }
-    num_snp_cols = col_counter;
-
-    setData(matrix);
-    file.close();
 
     snp_data_set = true;
+    indicator_data_set = with_indicators;
 }
 
 void FHESIMDDatabase::setColumnHeaders(vector<string> &headers)
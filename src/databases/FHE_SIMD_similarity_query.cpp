@@ -30,26 +30,20 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQuery(uint32_t target_
         throw "Too many deletes";
     }
 
-    vector<vector<helib::Ctxt>> normalized_scores = vector<vector<helib::Ctxt>>();
+    // Squared distances are summed in degree-2 form, one relinearization per row
+    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
 
     for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
-        vector<helib::Ctxt> temp = vector<helib::Ctxt>();
+        helib::Ctxt score(meta.data->publicKey);
         for (size_t i = 0; i < d.size(); i++)
         {
-            helib::Ctxt clone = getGenotype(i, j);
+            helib::Ctxt clone = *viewGenotype(i, j);
             clone -= d[i];
-            clone.square();
-
-            temp.push_back(clone);
+            addSquareNoRelin(score, clone);
         }
-        normalized_scores.push_back(temp);
-    }
-    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
-
-    for (uint32_t j = 0; j < num_compressed_rows; j++)
-    {
-        scores.push_back(addManySafe(normalized_scores[j], meta.data->publicKey));
+        score.cleanUp();
+        scores.push_back(std::move(score));
     }
 
     if (constants::DEBUG)
@@ -102,7 +96,7 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQuery(uint32_t target_
     for (uint32_t j = 0; j < num_compressed_rows; j++)
     {
         inverse_target_column[j].multiplyBy(predicate[j]);
-        predicate[j].multiplyBy(getBinaryPheno(target_column, j));
+        predicate[j].multiplyBy(*viewBinaryPheno(target_column, j));
     }
 
     helib::Ctxt count_with = addManySafe(predicate, meta.data->publicKey);
@@ -114,27 +108,21 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQuery(uint32_t target_
     return pair(count_with, count_without);
 }
 
-void process_iteration_similarity(FHESIMDDatabase *db,
+void process_iteration_similarity(const FHESIMDDatabase *db,
                                   std::vector<helib::Ctxt> &d,
                                   std::vector<helib::Ctxt> &scores,
-                                  size_t start_idx,
-                                  size_t end_idx,
-                                  std::mutex &scores_mutex)
+                                  size_t block,
+                                  size_t block_size)
 {
+    size_t start_idx = block * block_size;
+    size_t end_idx = min(d.size(), start_idx + block_size);
 
-    helib::Ctxt score = db->getGenotype(start_idx, 0);
-    score -= d[start_idx];
-    score.square();
-    for (size_t i = start_idx + 1; i < end_idx; i++)
+    for (size_t i = start_idx; i < end_idx; i++)
     {
-        helib::Ctxt clone = db->getGenotype(i, 0);
+        helib::Ctxt clone = *db->viewGenotype(i, 0);
         clone -= d[i];
-        clone.square();
-        score += clone;
+        addSquareNoRelin(scores[block], clone);
     }
-
-    std::lock_guard<std::mutex> lock(scores_mutex);
-    scores.push_back(std::move(score));
 }
 
 pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQueryP(uint32_t target_column, std::vector<helib::Ctxt> &d, uint32_t threshold, uint32_t num_threads)
@@ -145,39 +133,23 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQueryP(uint32_t target
         throw "Invalid setup";
     }
 
-    uint32_t t = num_threads;
-    uint32_t num_snps = d.size();
-
-    size_t chunk_size = num_snps / t;
-
-    vector<helib::Ctxt> scores = vector<helib::Ctxt>();
-    scores.reserve(t);
-
-    std::mutex scores_mutex;
-
-    std::vector<std::thread> threads;
-    for (size_t i = 0; i < t; i++)
+    if (d.size() == 0)
     {
+        throw invalid_argument("ERROR: Similarity query needs a target patient");
+    }
 
-        size_t start_idx = i * chunk_size;
-        size_t end_idx = (i == t - 1) ? num_snps : (i + 1) * chunk_size;
-
-        if (start_idx >= end_idx)
-        {
-            continue;
-        }
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
 
-        threads.emplace_back(process_iteration_similarity, this,
-                             std::ref(d), std::ref(scores),
-                             start_idx, end_idx, std::ref(scores_mutex));
-    }
+    // A few blocks per thread so that faster threads steal the remainder
+    size_t num_blocks = min(d.size(), (size_t)4 * pool->concurrency());
+    size_t block_size = (d.size() + num_blocks - 1) / num_blocks;
 
-    for (auto &thread : threads)
-    {
-        thread.join();
-    }
+    vector<helib::Ctxt> scores = vector<helib::Ctxt>(num_blocks, helib::Ctxt(meta.data->publicKey));
+    pool->parallelFor(0, num_blocks, [&](size_t block)
+                      { process_iteration_similarity(this, d, scores, block, block_size); });
 
-    helib::Ctxt scores_all = addManySafe(scores, meta.data->publicKey);
+    helib::Ctxt scores_all = addManyParallel(scores, meta.data->publicKey, *pool);
+    scores_all.cleanUp();
 
     helib::Ptxt<helib::BGV> ptxt_threshold(meta.data->context);
     for (uint32_t i = 0; i < num_slots; i++)
@@ -199,7 +171,7 @@ pair<helib::Ctxt, helib::Ctxt> FHESIMDDatabase::similarityQueryP(uint32_t target
     inverse_target.multByConstant(mask);
 
     inverse_target.multiplyBy(predicate);
-    predicate.multiplyBy(getBinaryPheno(target_column, 0));
+    predicate.multiplyBy(*viewBinaryPheno(target_column, 0));
 
     helib::Ctxt count_with = predicate;
     helib::Ctxt count_without = inverse_target;
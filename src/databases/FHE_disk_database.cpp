@@ -18,35 +18,20 @@ void FHEDiskDatabase::genData(uint32_t num_rows, uint32_t num_snp_cols, uint32_t
     this->num_rows = num_rows;
     this->num_snp_cols = num_snp_cols;
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(0, 2);
-
     this->num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
 
     for (uint32_t i = 0; i < num_snp_cols; i++)
     {
-        uint32_t rows_set = 0;
-
         createColumnDir(i);
-
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
+        if (with_indicators)
         {
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = dis(gen);
-                rows_set += 1;
-            }
-
-            helib::Ctxt ctxt = encrypt(ptxt);
-
-            saveCtxt(ctxt, i, j);
+            createIndicatorDirs(i);
         }
     }
+    saveColumns(genColumns(num_snp_cols, 0, 2, seed), 0, "");
+
     this->snp_data_set = true;
+    this->indicator_data_set = with_indicators;
     storeDBMetadata();
 }
 
@@ -59,29 +44,12 @@ void FHEDiskDatabase::genBinaryPhenoData(uint32_t num_binary_pheno_cols, uint32_
 
     this->num_binary_pheno_cols = num_binary_pheno_cols;
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(0, 1);
-
     for (uint32_t i = 0; i < num_binary_pheno_cols; i++)
     {
         createColumnDirPheno(i, "_binary");
-
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = dis(gen);
-            }
-
-            helib::Ctxt ctxt = encrypt(ptxt);
-
-            saveCtxtPheno(ctxt, i, j, "_binary");
-        }
     }
+    saveColumns(genColumns(num_binary_pheno_cols, 0, 1, seed), 0, "_binary");
+
     this->binary_phenotype_data_set = true;
     storeDBMetadata();
 }
@@ -95,51 +63,32 @@ void FHEDiskDatabase::genContinuousPhenoData(uint32_t num_continuous_pheno_cols,
 
     this->num_continuous_pheno_cols = num_continuous_pheno_cols;
 
-    random_device rd;
-    mt19937 gen(seed);
-    uniform_int_distribution<> dis(low, high);
-
     for (uint32_t i = 0; i < num_continuous_pheno_cols; i++)
     {
         createColumnDirPheno(i, "_continuous");
-
-        for (uint32_t j = 0; j < num_compressed_rows; j++)
-        {
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-            uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = dis(gen);
-            }
-
-            helib::Ctxt ctxt = encrypt(ptxt);
-
-            saveCtxtPheno(ctxt, i, j, "_continuous");
-        }
     }
+    saveColumns(genColumns(num_continuous_pheno_cols, low, high, seed), 0, "_continuous");
+
     this->continuous_phenotype_data_set = true;
     storeDBMetadata();
 }
 
-void encryption_thread(FHEDiskDatabase *db, uint32_t start, uint32_t end, vector<vector<int32_t>> &data, uint32_t num_slots, uint32_t num_rows)
+void FHEDiskDatabase::saveColumns(const vector<vector<int32_t>> &columns, uint32_t first_column, const string &postfix)
 {
-    for (uint32_t i = start; i < end; i++)
-    {
-        for (uint32_t j = 0; j < db->num_compressed_rows; j++)
+    bool indicators = postfix.empty() && with_indicators;
+    getThreadPool(encryptionThreads())->parallelFor(0, columns.size() * num_compressed_rows, [&](size_t task)
+                                                    {
+        uint32_t c = task / num_compressed_rows;
+        uint32_t j = task % num_compressed_rows;
+        helib::Ctxt ctxt = encryptBlock(columns[c], j);
+        saveCtxtPheno(ctxt, first_column + c, j, postfix);
+
+        if (indicators)
         {
-            vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
             uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-
-            for (uint32_t k = 0; k < entries_left; k++)
-            {
-                ptxt[k] = data[i][j * num_slots + k];
-            }
-            helib::Ctxt ctxt = db->encrypt(ptxt);
-            db->saveCtxt(ctxt, i, j);
-        }
-    }
+            vector<int32_t> genotypes(columns[c].begin() + j * num_slots, columns[c].begin() + j * num_slots + entries_left);
+            saveIndicatorBlock(genotypes, first_column + c, j);
+        } });
 }
 
 void FHEDiskDatabase::setData(vector<vector<int32_t>> &db)
@@ -162,34 +111,23 @@ void FHEDiskDatabase::setData(vector<vector<int32_t>> &db)
     for (uint32_t i = 0; i < num_snp_cols; i++)
     {
         createColumnDir(i);
-    }
-
-    vector<thread> threads;
-
-    for (uint32_t i = 0; i < num_threads_encryption; i++)
-    {
-        uint32_t start = i * num_snp_cols / num_threads_encryption;
-        uint32_t end = (i + 1) * num_snp_cols / num_threads_encryption;
-        if (i == num_threads_encryption - 1)
+        if (with_indicators)
         {
-            end = num_snp_cols;
+            createIndicatorDirs(i);
         }
-        threads.push_back(thread(encryption_thread, this, start, end, ref(db), num_slots, num_rows));
     }
 
-    for (auto &t : threads)
-    {
-        t.join();
-    }
+    saveColumns(db, 0, "");
 
     this->snp_data_set = true;
+    this->indicator_data_set = with_indicators;
     storeDBMetadata();
 }
 
 void FHEDiskDatabase::multithreadSetData(string vcf_file, uint32_t num_threads)
 {
     num_threads_encryption = num_threads;
-    FHESIMDDatabase::setData(vcf_file);
+    setVCFData(vcf_file);
 }
 
 bool FHEDiskDatabase::checkIfDiskDirExists()
@@ -223,6 +161,12 @@ void FHEDiskDatabase::createDiskDir()
 
 void FHEDiskDatabase::createColumnDir(uint32_t col)
 {
+    // Segment files replace the per-column directories
+    if (segments)
+    {
+        return;
+    }
+
     // Create the column directory
     std::filesystem::path dir(this->DISK_DIR_FULL + "/" + std::to_string(col));
     try
@@ -244,6 +188,12 @@ void FHEDiskDatabase::createColumnDir(uint32_t col)
 
 void FHEDiskDatabase::createColumnDirPheno(uint32_t col, std::string postfix)
 {
+    // Segment files replace the per-column directories
+    if (segments)
+    {
+        return;
+    }
+
     // Create the column directory
     std::filesystem::path dir(this->DISK_DIR_FULL + "/" + std::to_string(col) + postfix);
     try
@@ -263,87 +213,382 @@ void FHEDiskDatabase::createColumnDirPheno(uint32_t col, std::string postfix)
     }
 }
 
+void FHEDiskDatabase::createIndicatorDirs(uint32_t col)
+{
+    for (uint32_t value = 0; value < 3; value++)
+    {
+        createColumnDirPheno(col, "_eq" + std::to_string(value));
+    }
+}
+
 void FHEDiskDatabase::saveCtxt(helib::Ctxt &ctxt, uint32_t col, uint32_t row)
 {
-    // Save the ciphertext to disk
-    std::string filename = this->DISK_DIR_FULL + "/" + std::to_string(col) + "/" + std::to_string(row) + ".ctxt";
-    std::ofstream ofs(filename, std::ios::binary);
-    ctxt.writeTo(ofs);
-    ofs.close();
+    saveCtxtPheno(ctxt, col, row, "");
 }
 
 void FHEDiskDatabase::setGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index)
 {
     saveCtxt(ctxt, column, compressed_row_index);
+    refreshIndicators(column, compressed_row_index);
+}
+
+void FHEDiskDatabase::storeGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index)
+{
+    saveCtxt(ctxt, column, compressed_row_index);
+}
+
+void FHEDiskDatabase::growCompressedRows(uint32_t num_rows)
+{
+    // Genotype and indicator ciphertexts of new compressed rows are written by flushInserts
+    for (uint32_t j = num_compressed_rows; j < num_rows; j++)
+    {
+        for (uint32_t c = 0; c < num_binary_pheno_cols; c++)
+        {
+            helib::Ctxt zero = zero_pool->take();
+            saveCtxtPheno(zero, c, j, "_binary");
+        }
+        for (uint32_t c = 0; c < num_continuous_pheno_cols; c++)
+        {
+            helib::Ctxt zero = zero_pool->take();
+            saveCtxtPheno(zero, c, j, "_continuous");
+        }
+    }
+}
+
+void FHEDiskDatabase::flushInserts()
+{
+    FHESIMDDatabase::flushInserts();
+    storeDBMetadata();
+}
+
+void FHEDiskDatabase::setIndicator(helib::Ctxt ctxt, uint32_t column, uint32_t value, uint32_t compressed_row_index)
+{
+    saveCtxtPheno(ctxt, column, compressed_row_index, "_eq" + std::to_string(value));
+}
+
+void FHEDiskDatabase::saveIndicatorBlock(const vector<int32_t> &genotypes, uint32_t col, uint32_t row)
+{
+    vector<helib::Ctxt> indicators = encryptIndicatorBlock(genotypes);
+    for (uint32_t value = 0; value < 3; value++)
+    {
+        saveCtxtPheno(indicators[value], col, row, "_eq" + std::to_string(value));
+    }
 }
 
 void FHEDiskDatabase::saveCtxtPheno(helib::Ctxt &ctxt, uint32_t col, uint32_t row, string postfix)
 {
-    // Save the ciphertext to disk
-    std::string filename = this->DISK_DIR_FULL + "/" + std::to_string(col) + postfix + "/" + std::to_string(row) + ".ctxt";
-    std::ofstream ofs(filename, std::ios::binary);
-    ctxt.writeTo(ofs);
-    ofs.close();
+    uint32_t kind = cacheKind(postfix);
+    std::unique_lock<std::shared_mutex> lock(ctxtLock(kind, col, row));
+
+    if (segments)
+    {
+        segments->write(segmentKind(postfix), col, row, ctxt);
+    }
+    else
+    {
+        // Save the ciphertext to disk
+        std::string filename = this->DISK_DIR_FULL + "/" + std::to_string(col) + postfix + "/" + std::to_string(row) + ".ctxt";
+        std::ofstream ofs(filename, std::ios::binary);
+        ctxt.writeTo(ofs);
+        ofs.close();
+    }
+
+    // Evicted once the new ciphertext is stored, a reader that missed before sees it on disk
+    ctxt_cache.erase(kind, col, row);
+}
+
+std::shared_mutex &FHEDiskDatabase::ctxtLock(uint32_t kind, uint32_t column, uint32_t row) const
+{
+    return ctxt_locks[(uint64_t(column) * 31 + row * 7 + kind) % CTXT_LOCK_STRIPES];
 }
 
 helib::Ctxt FHEDiskDatabase::getGenotype(uint32_t column, uint32_t row) const
 {
-    if (!snp_data_set)
+    return *viewGenotype(column, row);
+}
+
+helib::Ctxt FHEDiskDatabase::getContinuousPheno(uint32_t column, uint32_t row) const
+{
+    return *viewContinuousPheno(column, row);
+}
+
+helib::Ctxt FHEDiskDatabase::getBinaryPheno(uint32_t column, uint32_t row) const
+{
+    return *viewBinaryPheno(column, row);
+}
+
+helib::Ctxt FHEDiskDatabase::getIndicator(uint32_t column, uint32_t value, uint32_t row) const
+{
+    return *viewIndicator(column, value, row);
+}
+
+helib::Ctxt FHEDiskDatabase::loadCtxt(uint32_t column, uint32_t row, string postfix) const
+{
+    if (segments)
     {
-        std::cout << "SNP data not set." << std::endl;
-        exit(1);
+        return segments->read(segmentKind(postfix), column, row, meta.data->publicKey);
     }
 
-    std::string filename = DISK_DIR_FULL + "/" + std::to_string(column) + "/" + std::to_string(row) + ".ctxt";
+    std::string filename = DISK_DIR_FULL + "/" + std::to_string(column) + postfix + "/" + std::to_string(row) + ".ctxt";
     std::ifstream ifs(filename, std::ios::binary);
     if (!ifs)
     {
-        std::cout << "Cannot open file for reading" << std::endl;
-        std::cout << "file: " << filename << std::endl;
-        exit(1);
+        // Thrown rather than exiting, read-ahead threads load through here as well
+        throw invalid_argument("ERROR: cannot open ciphertext file " + filename);
     }
 
     return helib::Ctxt::readFrom(ifs, meta.data->publicKey);
 }
 
-helib::Ctxt FHEDiskDatabase::getContinuousPheno(uint32_t column, uint32_t row) const
+uint32_t FHEDiskDatabase::cacheKind(const string &postfix)
+{
+    if (postfix.empty())
+    {
+        return 0;
+    }
+    if (postfix == "_binary")
+    {
+        return 1;
+    }
+    if (postfix == "_continuous")
+    {
+        return 2;
+    }
+    // "_eq0", "_eq1", "_eq2"
+    return 3 + (postfix.back() - '0');
+}
+
+string FHEDiskDatabase::cachePostfix(uint32_t kind)
+{
+    switch (kind)
+    {
+    case 0:
+        return "";
+    case 1:
+        return "_binary";
+    case 2:
+        return "_continuous";
+    default:
+        return "_eq" + std::to_string(kind - 3);
+    }
+}
+
+shared_ptr<const helib::Ctxt> FHEDiskDatabase::cacheCtxt(uint32_t column, uint32_t row, string postfix) const
+{
+    uint32_t kind = cacheKind(postfix);
+    shared_ptr<const helib::Ctxt> ctxt = ctxt_cache.get(kind, column, row);
+    if (ctxt)
+    {
+        return ctxt;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(ctxtLock(kind, column, row));
+    ctxt = make_shared<const helib::Ctxt>(loadCtxt(column, row, postfix));
+    // Stored ciphertexts are relinearized: two parts with one limb per prime
+    size_t bytes = 2 * ctxt->getPrimeSet().card() * meta.data->context.getPhiM() * sizeof(long);
+    ctxt_cache.put(kind, column, row, ctxt, bytes);
+    return ctxt;
+}
+
+shared_ptr<const helib::Ctxt> FHEDiskDatabase::loadCachedCtxt(uint32_t column, uint32_t row, string postfix) const
+{
+    shared_ptr<const helib::Ctxt> ctxt = cacheCtxt(column, row, postfix);
+    if (read_ahead)
+    {
+        read_ahead->consumed(cacheKind(postfix), column, row);
+    }
+    return ctxt;
+}
+
+void FHEDiskDatabase::startReadAhead(uint32_t num_threads)
+{
+    read_ahead.reset();
+    if (num_threads == 0)
+    {
+        return;
+    }
+    read_ahead = std::make_unique<ReadAhead>([this](const ReadAhead::Item &item)
+                                             {
+        if (!ctxt_cache.contains(item.kind, item.column, item.row))
+        {
+            cacheCtxt(item.column, item.row, cachePostfix(item.kind));
+        } },
+                                             num_threads);
+}
+
+shared_ptr<void> FHEDiskDatabase::readAhead(vector<CtxtAddress> addresses) const
+{
+    if (!read_ahead)
+    {
+        return nullptr;
+    }
+
+    vector<ReadAhead::Item> items = vector<ReadAhead::Item>();
+    items.reserve(addresses.size());
+    for (const CtxtAddress &address : addresses)
+    {
+        string postfix;
+        switch (address.kind)
+        {
+        case CtxtAddress::GENOTYPE:
+            postfix = "";
+            break;
+        case CtxtAddress::BINARY_PHENO:
+            postfix = "_binary";
+            break;
+        case CtxtAddress::CONTINUOUS_PHENO:
+            postfix = "_continuous";
+            break;
+        case CtxtAddress::INDICATOR:
+            postfix = "_eq" + std::to_string(address.value);
+            break;
+        }
+        items.push_back({cacheKind(postfix), address.column, address.row});
+    }
+    return read_ahead->start(std::move(items));
+}
+
+CtxtHandle FHEDiskDatabase::viewGenotype(uint32_t column, uint32_t row) const
 {
     if (!snp_data_set)
     {
         std::cout << "SNP data not set." << std::endl;
         exit(1);
     }
+    return CtxtHandle(loadCachedCtxt(column, row, ""));
+}
 
-    std::string filename = DISK_DIR_FULL + "/" + std::to_string(column) + "_continuous/" + std::to_string(row) + ".ctxt";
-    std::ifstream ifs(filename, std::ios::binary);
-    if (!ifs)
+CtxtHandle FHEDiskDatabase::viewContinuousPheno(uint32_t column, uint32_t row) const
+{
+    if (!snp_data_set)
     {
-        std::cout << "Cannot open file for reading" << std::endl;
-        std::cout << "file: " << filename << std::endl;
+        std::cout << "SNP data not set." << std::endl;
         exit(1);
     }
-
-    return helib::Ctxt::readFrom(ifs, meta.data->publicKey);
+    return CtxtHandle(loadCachedCtxt(column, row, "_continuous"));
 }
 
-helib::Ctxt FHEDiskDatabase::getBinaryPheno(uint32_t column, uint32_t row) const
+CtxtHandle FHEDiskDatabase::viewBinaryPheno(uint32_t column, uint32_t row) const
 {
     if (!snp_data_set)
     {
         std::cout << "SNP data not set." << std::endl;
         exit(1);
     }
+    return CtxtHandle(loadCachedCtxt(column, row, "_binary"));
+}
 
-    std::string filename = DISK_DIR_FULL + "/" + std::to_string(column) + "_binary/" + std::to_string(row) + ".ctxt";
-    std::ifstream ifs(filename, std::ios::binary);
-    if (!ifs)
+CtxtHandle FHEDiskDatabase::viewIndicator(uint32_t column, uint32_t value, uint32_t row) const
+{
+    if (!indicator_data_set)
     {
-        std::cout << "Cannot open file for reading" << std::endl;
-        std::cout << "file: " << filename << std::endl;
+        std::cout << "Indicator data not set." << std::endl;
         exit(1);
     }
+    if (value > 2)
+    {
+        throw invalid_argument("ERROR: indicator columns only exist for values 0, 1 and 2");
+    }
+    return CtxtHandle(loadCachedCtxt(column, row, "_eq" + std::to_string(value)));
+}
 
-    return helib::Ctxt::readFrom(ifs, meta.data->publicKey);
+void FHEDiskDatabase::openSegmentStore()
+{
+    if (segmented && !segments)
+    {
+        segments = std::make_unique<SegmentStore>(DISK_DIR_FULL + "/" + SEGMENT_DIR);
+    }
+}
+
+void FHEDiskDatabase::migrateToSegments(bool keep_files, uint32_t num_threads)
+{
+    if (segments)
+    {
+        std::cout << "Database already uses segment files" << std::endl;
+        return;
+    }
+
+    vector<string> postfixes = vector<string>();
+    vector<uint32_t> column_counts = vector<uint32_t>();
+    if (snp_data_set)
+    {
+        postfixes.push_back("");
+        column_counts.push_back(num_snp_cols);
+    }
+    if (indicator_data_set)
+    {
+        for (uint32_t value = 0; value < 3; value++)
+        {
+            postfixes.push_back("_eq" + std::to_string(value));
+            column_counts.push_back(num_snp_cols);
+        }
+    }
+    if (binary_phenotype_data_set)
+    {
+        postfixes.push_back("_binary");
+        column_counts.push_back(num_binary_pheno_cols);
+    }
+    if (continuous_phenotype_data_set)
+    {
+        postfixes.push_back("_continuous");
+        column_counts.push_back(num_continuous_pheno_cols);
+    }
+
+    // Copied into a store of its own, the database keeps reading the old files until every copy succeeded
+    std::string segment_dir = DISK_DIR_FULL + "/" + SEGMENT_DIR;
+    std::unique_ptr<SegmentStore> store = std::make_unique<SegmentStore>(segment_dir);
+
+    // Ciphertexts are parsed on the way, so a damaged file stops the migration before anything is deleted
+    shared_ptr<ThreadPool> pool = getThreadPool(num_threads);
+    try
+    {
+        for (size_t k = 0; k < postfixes.size(); k++)
+        {
+            pool->parallelFor(0, column_counts[k], [&](size_t column)
+                              {
+                for (uint32_t row = 0; row < num_compressed_rows; row++)
+                {
+                    std::string filename = DISK_DIR_FULL + "/" + std::to_string(column) + postfixes[k] + "/" + std::to_string(row) + ".ctxt";
+                    std::ifstream ifs(filename, std::ios::binary);
+                    if (!ifs)
+                    {
+                        throw invalid_argument("ERROR: cannot open " + filename);
+                    }
+                    store->write(segmentKind(postfixes[k]), column, row, helib::Ctxt::readFrom(ifs, meta.data->publicKey));
+                } });
+        }
+        store->flush();
+    }
+    catch (...)
+    {
+        store.reset();
+        std::filesystem::remove_all(segment_dir);
+        throw;
+    }
+
+    // Same ciphertexts in the new layout, cached ones stay valid
+    segments = std::move(store);
+    segmented = true;
+    storeDBMetadata();
+
+    if (!keep_files)
+    {
+        for (size_t k = 0; k < postfixes.size(); k++)
+        {
+            for (uint32_t column = 0; column < column_counts[k]; column++)
+            {
+                std::filesystem::remove_all(DISK_DIR_FULL + "/" + std::to_string(column) + postfixes[k]);
+            }
+        }
+    }
+}
+
+void FHEDiskDatabase::compactSegments()
+{
+    if (segments)
+    {
+        segments->compact();
+    }
 }
 
 void FHEDiskDatabase::storeMetadata()
@@ -355,6 +600,11 @@ void FHEDiskDatabase::storeMetadata()
 
 void FHEDiskDatabase::storeDBMetadata()
 {
+    if (segments)
+    {
+        segments->flush();
+    }
+
     // Save the database metadata to disk
     std::string db_filename = DISK_DIR_FULL + "/" + DB_META_FILE;
     std::ofstream ofs(db_filename);
@@ -367,6 +617,8 @@ void FHEDiskDatabase::storeDBMetadata()
     ofs << this->snp_data_set << std::endl;
     ofs << this->continuous_phenotype_data_set << std::endl;
     ofs << this->binary_phenotype_data_set << std::endl;
+    ofs << this->indicator_data_set << std::endl;
+    ofs << this->segmented << std::endl;
     ofs.close();
 }
 
@@ -374,6 +626,11 @@ void FHEDiskDatabase::loadDBMetadata()
 {
     std::string db_filename = DISK_DIR_FULL + "/" + DB_META_FILE;
     std::ifstream ifs(db_filename);
+    if (!ifs)
+    {
+        // Nothing stored yet, a new database starts out with segment files
+        return;
+    }
     ifs >> num_rows;
     ifs >> num_snp_cols;
     ifs >> num_compressed_rows;
@@ -382,6 +639,17 @@ void FHEDiskDatabase::loadDBMetadata()
     ifs >> snp_data_set;
     ifs >> continuous_phenotype_data_set;
     ifs >> binary_phenotype_data_set;
+    // Older metadata files predate indicator columns
+    if (!(ifs >> indicator_data_set))
+    {
+        indicator_data_set = false;
+    }
+    with_indicators = indicator_data_set;
+    // Databases written before segment files keep one file per ciphertext until migrated
+    if (!(ifs >> segmented))
+    {
+        segmented = false;
+    }
     ifs.close();
 }
 
@@ -479,82 +747,87 @@ string FHEDiskDatabase::printDBString(bool with_headers) const
 
 void FHEDiskDatabase::setVCFData(string vcf_file)
 {
-    std::ifstream file(vcf_file);
-    if (!file.is_open())
+    VCFReader reader;
+    if (!reader.open(vcf_file))
     {
         std::cout << "Error opening file: " << vcf_file << std::endl;
         return;
     }
 
-    uint32_t col_counter = 0;
-    uint32_t row_counter = 0;
-    uint32_t delimiter_counter = 0;
-
-    std::vector<std::vector<int32_t>> matrix;
-    std::string line;
-    while (std::getline(file, line))
+    if (!checkIfDiskDirExists())
     {
-        // Skip header lines starting with "#"
-        if (line[0] == '#')
-            continue;
+        createDiskDir();
+    }
 
-        std::vector<int32_t> row;
+    // Parse -> pack -> encrypt -> write, one batch of columns at a time: while the pool
+    // encrypts a batch the next one is parsed, so at most two batches are held in memory.
+    // The parser splits its batch over the same pool, idle workers pick up its line ranges.
+    uint32_t batch_size = 2 * encryptionThreads();
+    shared_ptr<ThreadPool> pool = getThreadPool(encryptionThreads());
 
-        col_counter += 1;
+    vector<string> names = vector<string>();
+    vector<vector<int32_t>> batch = vector<vector<int32_t>>();
+    vector<string> next_names = vector<string>();
+    vector<vector<int32_t>> next_batch = vector<vector<int32_t>>();
 
-        std::istringstream iss(line);
-        std::string token;
-        while (std::getline(iss, token, '\t'))
-        {
-            if (delimiter_counter == 2)
-            { // When we are reading in the snp name
-                column_headers.push_back(token);
-            }
+    num_snp_cols = 0;
+    bool more = reader.nextBatch(batch_size, names, batch, pool.get()) > 0;
+    if (!more)
+    {
+        throw invalid_argument("ERROR: DB has zero columns! THIS DOES NOT WORK!");
+    }
+    num_rows = reader.numSamples();
+    num_compressed_rows = num_rows % num_slots == 0 ? num_rows / num_slots : (num_rows / num_slots) + 1;
 
-            delimiter_counter += 1;
-            if (delimiter_counter < 9)
-            {
-                continue;
-            }
-            if (token.find(".") != std::string::npos)
-            {
-                row.push_back(-1);
-                row_counter += 1;
-                continue;
-            }
-            if (token == "1/1" || token == "1|1")
-            {
-                row.push_back(2);
-                row_counter += 1;
-            }
-            if (token == "0/1" || token == "0|1")
+    while (more)
+    {
+        for (uint32_t c = 0; c < batch.size(); c++)
+        {
+            createColumnDir(num_snp_cols + c);
+            if (with_indicators)
             {
-                row.push_back(1);
-                row_counter += 1;
+                createIndicatorDirs(num_snp_cols + c);
             }
-            if (token == "1|0")
+        }
+        column_headers.insert(column_headers.end(), names.begin(), names.end());
+
+        exception_ptr parse_error = nullptr;
+        bool next_more = false;
+        thread parser([&]
+                      {
+            try
             {
-                row.push_back(1);
-                row_counter += 1;
+                next_more = reader.nextBatch(batch_size, next_names, next_batch, pool.get()) > 0;
             }
-            if (token == "0/0" || token == "0|0")
+            catch (...)
             {
-                row.push_back(0);
-                row_counter += 1;
-            }
+                parse_error = current_exception();
+            } });
+
+        try
+        {
+            saveColumns(batch, num_snp_cols, "");
+        }
+        catch (...)
+        {
+            parser.join();
+            throw;
+        }
+        parser.join();
+        if (parse_error)
+        {
+            rethrow_exception(parse_error);
         }
-        num_rows = row_counter;
-        row_counter = 0;
-        delimiter_counter = 0;
 
-        matrix.push_back(row);
+        num_snp_cols += batch.size();
+        swap(names, next_names);
+        swap(batch, next_batch);
+        more = next_more;
     }
-    num_snp_cols = col_counter;
-
-    setData(matrix);
-    file.close();
 
     snp_data_set = true;
+    indicator_data_set = with_indicators;
+    storeDBMetadata();
 }
 
 void FHEDiskDatabase::setPhenoData(string pheno_file)
@@ -575,105 +848,100 @@ void FHEDiskDatabase::setPhenoData(string pheno_file)
         headers.push_back(token);
     }
 
-    vector<vector<int32_t>> matrix;
+    // Single pass: values go straight into their column and a column stays binary
+    // as long as it only holds 0 and 1
+    uint32_t num_pheno_cols = headers.size();
+    vector<vector<int32_t>> columns = vector<vector<int32_t>>(num_pheno_cols);
+    vector<bool> is_binary = vector<bool>(num_pheno_cols, true);
+    for (auto &column : columns)
+    {
+        column.reserve(num_rows);
+    }
+
+    uint32_t line_number = 1;
     std::string line;
     while (std::getline(file, line))
     {
-        std::vector<int32_t> row;
-        std::istringstream iss(line);
-        std::string token;
-        while (std::getline(iss, token, ','))
+        line_number += 1;
+        if (!line.empty() && line.back() == '\r')
         {
-            if (token == "NA")
+            line.pop_back();
+        }
+        if (line.empty())
+        {
+            continue;
+        }
+
+        uint32_t c = 0;
+        size_t begin = 0;
+        while (begin <= line.size())
+        {
+            size_t end = line.find(',', begin);
+            if (end == std::string::npos)
             {
-                row.push_back(-1);
+                end = line.size();
             }
-            else
+            if (c >= num_pheno_cols)
             {
-                row.push_back(std::stoi(token));
+                throw invalid_argument("ERROR: phenotype line " + std::to_string(line_number) + " has more fields than the header");
             }
-        }
-        matrix.push_back(row);
-    }
 
-    // transpose matrix
-    vector<vector<int32_t>> transposed_matrix;
-    for (uint32_t i = 0; i < matrix[0].size(); i++)
-    {
-        vector<int32_t> row;
-        for (uint32_t j = 0; j < matrix.size(); j++)
+            int32_t value = line.compare(begin, end - begin, "NA") == 0 ? -1 : std::stoi(line.substr(begin, end - begin));
+            columns[c].push_back(value);
+            if (value != 0 && value != 1)
+            {
+                is_binary[c] = false;
+            }
+            c += 1;
+            begin = end + 1;
+        }
+        if (c != num_pheno_cols)
         {
-            row.push_back(matrix[j][i]);
+            throw invalid_argument("ERROR: phenotype line " + std::to_string(line_number) + " has fewer fields than the header");
         }
-        transposed_matrix.push_back(row);
+    }
+    if (num_pheno_cols > 0 && columns[0].size() != num_rows)
+    {
+        throw invalid_argument("ERROR: phenotype file has " + std::to_string(columns[0].size()) + " rows, the genotypes have " + std::to_string(num_rows));
     }
 
     num_binary_pheno_cols = 0;
     num_continuous_pheno_cols = 0;
+    binary_pheno_headers = vector<string>();
+    continuous_pheno_headers = vector<string>();
 
-    for (uint32_t c = 0; c < matrix[0].size(); c++)
+    // Binary and continuous columns are numbered in file order within their kind
+    vector<string> postfixes = vector<string>(num_pheno_cols);
+    vector<uint32_t> indices = vector<uint32_t>(num_pheno_cols);
+    for (uint32_t c = 0; c < num_pheno_cols; c++)
     {
-        bool is_binary = true;
-        for (uint32_t r = 0; r < matrix.size(); r++)
-        {
-            if (matrix[r][c] != 0 && matrix[r][c] != 1)
-            {
-                is_binary = false;
-                break;
-            }
-        }
-        if (is_binary)
+        if (is_binary[c])
         {
             binary_pheno_headers.push_back(headers[c]);
-
-            createColumnDirPheno(num_binary_pheno_cols, "_binary");
-
-
-            uint32_t current_row = 0;
-            for (uint32_t j = 0; j < num_compressed_rows; j++)
-            {
-                vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-                uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-                for (uint32_t k = 0; k < entries_left; k++)
-                {
-                    ptxt[k] = transposed_matrix[c][current_row];
-                    current_row += 1;
-                }
-
-                helib::Ctxt ctxt = encrypt(ptxt);
-
-                saveCtxtPheno(ctxt, num_binary_pheno_cols, j, "_binary");
-            }
+            postfixes[c] = "_binary";
+            indices[c] = num_binary_pheno_cols;
             num_binary_pheno_cols += 1;
         }
         else
         {
             continuous_pheno_headers.push_back(headers[c]);
-
-            createColumnDirPheno(num_continuous_pheno_cols, "_continuous");
-
-            uint32_t current_row = 0;
-            for (uint32_t j = 0; j < num_compressed_rows; j++)
-            {
-                vector<unsigned long> ptxt = vector<unsigned long>(num_slots, 0);
-
-                uint32_t entries_left = min(num_slots, num_rows - (j * num_slots));
-                for (uint32_t k = 0; k < entries_left; k++)
-                {
-                    ptxt[k] = transposed_matrix[c][current_row];
-                    current_row += 1;
-                }
-
-                helib::Ctxt ctxt = encrypt(ptxt);
-
-
-
-                saveCtxtPheno(ctxt, num_continuous_pheno_cols, j, "_continuous");
-            }
+            postfixes[c] = "_continuous";
+            indices[c] = num_continuous_pheno_cols;
             num_continuous_pheno_cols += 1;
         }
+        createColumnDirPheno(indices[c], postfixes[c]);
     }
+
+    // Same worker pool as the genotypes, one task per column x compressed row
+    shared_ptr<ThreadPool> pool = getThreadPool(encryptionThreads());
+    pool->parallelFor(0, num_pheno_cols * num_compressed_rows, [&](size_t task)
+                      {
+        uint32_t c = task / num_compressed_rows;
+        uint32_t j = task % num_compressed_rows;
+        helib::Ctxt ctxt = encryptBlock(columns[c], j);
+        saveCtxtPheno(ctxt, indices[c], j, postfixes[c]); });
+
     continuous_phenotype_data_set = true;
     binary_phenotype_data_set = true;
+    storeDBMetadata();
 }
\ No newline at end of file
@@ -11,16 +11,23 @@
 #include <fstream>
 #include <unordered_map>
 #include <memory>
+#include <array>
+#include <shared_mutex>
 #include <helib/helib.h>
 #include "FHE_disk_database.hpp"
 #include "FHE_SIMD_database.hpp"
 #include "tools.hpp"
 #include "comparator.hpp"
+#include "segment_store.hpp"
+#include "ctxt_cache.hpp"
+#include "read_ahead.hpp"
 #include "../globals.hpp"
 
 #define DISK_DIR "/data/db_disk"
 #define META_FILEPATH "meta"
 #define DB_META_FILE "meta.db"
+#define SEGMENT_DIR "segments"
+#define CTXT_LOCK_STRIPES 64
 
 class FHEDiskDatabase : public FHESIMDDatabase
 {
@@ -34,6 +41,23 @@ public:
         {
             createDiskDir();
         }
+        openSegmentStore();
+        startReadAhead(DEFAULT_READ_AHEAD_THREADS);
+        storeMetadata();
+    }
+    // starting up a disk database in its own directory; without segment files every
+    // ciphertext is written to its own file, like databases created by older versions
+    FHEDiskDatabase(const Params &_params, bool _with_similarity, const std::string &disk_dir, bool _segmented)
+        : FHESIMDDatabase(_params, _with_similarity)
+    {
+        DISK_DIR_FULL = disk_dir;
+        segmented = _segmented;
+        if (!checkIfDiskDirExists())
+        {
+            createDiskDir();
+        }
+        openSegmentStore();
+        startReadAhead(DEFAULT_READ_AHEAD_THREADS);
         storeMetadata();
     }
     // starting up disk database for subsequent runs
@@ -47,6 +71,8 @@ public:
             storeMetadata();
         }
         loadDBMetadata();
+        openSegmentStore();
+        startReadAhead(DEFAULT_READ_AHEAD_THREADS);
     }
     ~FHEDiskDatabase() = default;
 
@@ -58,15 +84,37 @@ public:
     void setPhenoData(string pheno_file);
 
     void setData(vector<vector<int32_t>> &db) override;
+    // Streams the VCF into encrypted columns, same as setVCFData
+    void setData(string vcf_file) override { setVCFData(vcf_file); }
     void multithreadSetData(string vcf_file, uint32_t num_threads);
-    void setNumThreadsEncryption(uint32_t threads) { num_threads_encryption = threads; }
 
     void setGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index) override;
+    void flushInserts() override;
 
     helib::Ctxt getGenotype(uint32_t column, uint32_t row) const override;
     helib::Ctxt getContinuousPheno(uint32_t column, uint32_t row) const override;
     helib::Ctxt getBinaryPheno(uint32_t column, uint32_t row) const override;
 
+    helib::Ctxt getIndicator(uint32_t column, uint32_t value, uint32_t row) const override;
+    void setIndicator(helib::Ctxt ctxt, uint32_t column, uint32_t value, uint32_t compressed_row_index) override;
+
+    // The views share the cached ciphertext, the getters hand out a copy of it
+    CtxtHandle viewGenotype(uint32_t column, uint32_t row) const override;
+    CtxtHandle viewContinuousPheno(uint32_t column, uint32_t row) const override;
+    CtxtHandle viewBinaryPheno(uint32_t column, uint32_t row) const override;
+    CtxtHandle viewIndicator(uint32_t column, uint32_t value, uint32_t row) const override;
+
+    // Ciphertext cache, postfix names the column kind as in the directory layout ("", "_binary", "_continuous", "_eq0", ...)
+    void setCacheBudget(size_t bytes) { ctxt_cache.setBudget(bytes); }
+    void pinColumn(uint32_t column, std::string postfix = "") { ctxt_cache.pin(cacheKind(postfix), column); }
+    void unpinColumn(uint32_t column, std::string postfix = "") { ctxt_cache.unpin(cacheKind(postfix), column); }
+    CtxtCache::Stats cacheStats() const { return ctxt_cache.stats(); }
+
+    // Queries load their ciphertexts ahead on these threads into the cache, 0 turns read-ahead off
+    void startReadAhead(uint32_t num_threads);
+    shared_ptr<void> readAhead(vector<CtxtAddress> addresses) const override;
+
+
     void storeMetadata();
 
     void storeDBMetadata();
@@ -75,10 +123,25 @@ public:
     bool checkIfDiskDirExists();
     void createDiskDir();
 
+    // Ciphertexts live in segment files unless the database predates them
+    bool usesSegments() const { return segments != nullptr; }
+    void openSegmentStore();
+    // Moves a database from the one-file-per-ciphertext layout into segment files
+    void migrateToSegments(bool keep_files, uint32_t num_threads);
+    // Drops the ciphertexts superseded by updates and inserts from the segment files
+    void compactSegments();
+
     void createColumnDir(uint32_t column_idx);
     void createColumnDirPheno(uint32_t column_idx, std::string postfix);
+    void createIndicatorDirs(uint32_t column_idx);
     void saveCtxt(helib::Ctxt &ctxt, uint32_t column_idx, uint32_t row_idx);
     void saveCtxtPheno(helib::Ctxt &ctxt, uint32_t column_idx, uint32_t row_idx, std::string postfix);
+    void saveIndicatorBlock(const vector<int32_t> &genotypes, uint32_t column_idx, uint32_t row_idx);
+    // Encrypts and stores columns as first_column, first_column + 1, ..., with their indicators for SNP columns
+    void saveColumns(const vector<vector<int32_t>> &columns, uint32_t first_column, const std::string &postfix);
+    // Throws invalid_argument when the ciphertext is not stored
+    helib::Ctxt loadCtxt(uint32_t column_idx, uint32_t row_idx, std::string postfix) const;
+    shared_ptr<const helib::Ctxt> loadCachedCtxt(uint32_t column_idx, uint32_t row_idx, std::string postfix) const;
 
     std::string DISK_DIR_FULL;
 
@@ -88,7 +151,24 @@ public:
     const helib::SecKey &getSecretKey() const { return meta.data->secretKey; }
     uint32_t getNumRows() const { return num_rows; }
 private:
-    // Define the cache structures
-    uint32_t num_threads_encryption = 1;
+    mutable CtxtCache ctxt_cache;
+    static uint32_t cacheKind(const std::string &postfix);
+    static std::string cachePostfix(uint32_t kind);
+    shared_ptr<const helib::Ctxt> cacheCtxt(uint32_t column_idx, uint32_t row_idx, std::string postfix) const;
+    // A cache miss loads and caches under a shared lock, a write stores and evicts under an
+    // exclusive one, so a load cannot put the replaced ciphertext back into the cache
+    mutable std::array<std::shared_mutex, CTXT_LOCK_STRIPES> ctxt_locks;
+    std::shared_mutex &ctxtLock(uint32_t kind, uint32_t column_idx, uint32_t row_idx) const;
+
+    bool segmented = true;
+    std::unique_ptr<SegmentStore> segments;
+
+    static std::string segmentKind(const std::string &postfix) { return postfix.empty() ? "genotype" : postfix.substr(1); }
+
+    void storeGenotype(helib::Ctxt ctxt, uint32_t column, uint32_t compressed_row_index) override;
+    void growCompressedRows(uint32_t num_rows) override;
+
+    // Declared last, its threads are joined before the cache and segments go away
+    std::unique_ptr<ReadAhead> read_ahead;
 
 };
\ No newline at end of file
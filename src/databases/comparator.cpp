@@ -114,7 +114,7 @@ map<unsigned long, vector<vector<long>>> fcoefs {
   }
 };
 
-DoubleCRT Comparator::create_shift_mask(double& size, long shift)
+ZZX Comparator::create_shift_mask(double& size, long shift)
 {
 	cout << "Mask for shift " << shift << " is being created" << endl;
 	// get EncryptedArray
@@ -165,19 +165,18 @@ DoubleCRT Comparator::create_shift_mask(double& size, long shift)
 
 	size = conv<double>(embeddingLargestCoeff(mask_zzx, m_context.getZMStar()));
 
-	DoubleCRT mask_crt = DoubleCRT(mask_zzx, m_context, m_context.allPrimes());
-	return mask_crt;
+	return mask_zzx;
 }
 
-void Comparator::create_all_shift_masks()
+void Comparator::create_all_shift_masks(vector<ZZX>& constants, vector<double>& sizes)
 {
 	long shift = 1;
 	while (shift < m_expansionLen)
 	{
 		double size;
-	    DoubleCRT mask_ptxt = create_shift_mask(size, -shift);
-	    m_mulMasks.push_back(mask_ptxt);
-	    m_mulMasksSize.push_back(size);
+	    ZZX mask_zzx = create_shift_mask(size, -shift);
+	    constants.push_back(mask_zzx);
+	    sizes.push_back(size);
 
 	    shift <<=1;
 	}
@@ -349,86 +348,109 @@ void Comparator::compute_poly_params()
 	}
 }
 
-void Comparator::create_poly()
+void Comparator::load_less_poly()
 {
-	//cout << "Creating comparison polynomial" << endl;
 	// get p
-	unsigned long p = m_context.getP();;
+	unsigned long p = m_context.getP();
 
-	if(m_type == UNI)
-	{
-		// polynomial coefficient
-		ZZ_p coef;
-		coef.init(ZZ(p));
+	// polynomial coefficient
+	ZZ_p coef;
+	coef.init(ZZ(p));
 
-		// field element
-		ZZ_p field_elem;
-		field_elem.init(ZZ(p));
+	// field element
+	ZZ_p field_elem;
+	field_elem.init(ZZ(p));
 
-		// initialization of the univariate comparison polynomial
-		m_univar_less_poly = ZZX(INIT_MONO, 0, 0);
+	// initialization of the univariate comparison polynomial
+	m_univar_less_poly = ZZX(INIT_MONO, 0, 0);
 
-		// check if a file called polynomial_U_p.txt exists
-		// if it does, then read the coefficients from the file
-		// otherwise, compute the coefficients and write them to the file
-		string projectRoot = getProjectRootPath();
-    	string filename = projectRoot + "/data/polynomial_U_" + std::to_string(p) + ".txt";
-		ifstream file(filename);
+	// check if a file called polynomial_U_p.txt exists
+	// if it does, then read the coefficients from the file
+	// otherwise, compute the coefficients and write them to the file
+	string projectRoot = getProjectRootPath();
+	string filename = projectRoot + "/data/polynomial_U_" + std::to_string(p) + ".txt";
+	ifstream file(filename);
 
-		if (file.is_open())
+	if (file.is_open())
+	{
+		cout << "Found file with comparison polynomial coefficients" << endl;
+		string line;
+		getline(file, line);
+		istringstream iss(line);
+		vector<long> coefs;
+		long coef;
+		while (iss >> coef)
 		{
-			cout << "Found file with comparison polynomial coefficients" << endl;
-			string line;
-			getline(file, line);
-			istringstream iss(line);
-			vector<long> coefs;
-			long coef;
-			while (iss >> coef)
-			{
-				coefs.push_back(coef);
-			}
-			file.close();
+			coefs.push_back(coef);
+		}
+		file.close();
 
-			for (long i = 0; i < coefs.size(); i++)
+		for (long i = 0; i < coefs.size(); i++)
+		{
+			SetCoeff(m_univar_less_poly, i, coefs[i]);
+		}
+	}
+	else
+	{
+		// loop over all odd coefficient indices
+		for (long indx = 1; indx < p - 1; indx+=2)
+		{ 
+			// coefficient f_i = sum_a a^{p-1-indx} where a runs over [1,...,(p-1)/2]
+			coef = 1;
+			for(long a = 2; a <= ((p-1) >> 1); a++)
 			{
-				SetCoeff(m_univar_less_poly, i, coefs[i]);
+			field_elem = a;
+			coef += power(field_elem, p - 1 - indx);
 			}
+
+			m_univar_less_poly += ZZX(INIT_MONO, (indx-1) >> 1, rep(coef));
 		}
-		else
-		{
-			// loop over all odd coefficient indices
-			for (long indx = 1; indx < p - 1; indx+=2)
-			{ 
-				// coefficient f_i = sum_a a^{p-1-indx} where a runs over [1,...,(p-1)/2]
-				coef = 1;
-				for(long a = 2; a <= ((p-1) >> 1); a++)
-				{
-				field_elem = a;
-				coef += power(field_elem, p - 1 - indx);
-				}
 
-				m_univar_less_poly += ZZX(INIT_MONO, (indx-1) >> 1, rep(coef));
-			}
+		//write polynomial to file:
+		cout << "Writing comparison polynomial coefficients to file" << endl;
 
-			//write polynomial to file:
-			cout << "Writing comparison polynomial coefficients to file" << endl;
+		ostringstream oss;
+		oss << m_univar_less_poly;
+		string str = oss.str();
 
-			ostringstream oss;
-			oss << m_univar_less_poly;
-			string str = oss.str();
+		// remove first and last character
+		str = str.substr(1, str.size() - 2);
 
-			// remove first and last character
-			str = str.substr(1, str.size() - 2);
+		ofstream file;
 
-			ofstream file;
+		file.open(filename);
+		file << str;
+		file.close();
+	}
+}
 
-			file.open(filename);
-			file << str;
-			file.close();
+void Comparator::create_poly()
+{
+	//cout << "Creating comparison polynomial" << endl;
+	// get p
+	unsigned long p = m_context.getP();;
+
+	if(m_type == UNI)
+	{
+		// the cache holds the same coefficients as polynomial_U_<p>.txt
+		if (m_cache.isOpen())
+		{
+			m_univar_less_poly = m_cache.lessPoly();
+		}
+		else
+		{
+			load_less_poly();
 		}
 
 		m_univar_min_max_poly = m_univar_less_poly * ZZX(INIT_MONO, 1, 1);
 
+		// LT(z) = z * f(z^2) + (p+1)/2 * z^{p-1}
+		m_univar_less_full = ZZX(INIT_MONO, p - 1, (p + 1) >> 1);
+		for (long i = 0; i <= deg(m_univar_less_poly); i++)
+		{
+			m_univar_less_full += ZZX(INIT_MONO, 2 * i + 1, m_univar_less_poly[i]);
+		}
+
 		compute_poly_params();
 	}
 	else if (m_type == TAN)
@@ -565,7 +587,7 @@ void Comparator::find_prim_root(ZZ_pE& root) const
 	}
 }
 
-void Comparator::extraction_init()
+void Comparator::extraction_init(vector<ZZX>& constants, vector<double>& sizes)
 {
 	// get the total number of slots
 	const EncryptedArray& ea = m_context.getEA();
@@ -627,9 +649,6 @@ void Comparator::extraction_init()
 	//cout << "Extraction consts: " << endl;
 	for (long iCoef = 0; iCoef < d; iCoef++)
 	{
-		vector<DoubleCRT> tmp_crt_vec;
-		vector<double> size_vec;
-
 		for (long iFrob = 0; iFrob < d; iFrob++)
 		{
 			ZZX tmp = conv<ZZX>(rep(inv_trace_matrix[iFrob][iCoef]));
@@ -639,19 +658,15 @@ void Comparator::extraction_init()
 			vector<ZZX> vec_const(nslots, tmp);
 			ea.encode(tmp, vec_const);
 
-			DoubleCRT tmp_crt(tmp, m_context, m_context.allPrimes());
-
 			double const_size = conv<double>(embeddingLargestCoeff(tmp, m_context.getZMStar()));
-			size_vec.push_back(const_size);
+			sizes.push_back(const_size);
 
-			tmp_crt_vec.push_back(tmp_crt);
+			constants.push_back(tmp);
 		}
-		m_extraction_const.push_back(tmp_crt_vec);
-		m_extraction_const_size.push_back(size_vec);
 	}
 }
 
-void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) const
+void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x, bool hoisted) const
 {
 	HELIB_NTIMER_START(Extraction);
 	mod_p_coefs.clear();
@@ -668,11 +683,31 @@ void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) co
 	// get max slot degree
 	long d = m_context.getOrdP();
 
-	// TODO: how to use key switching hoisting from CRYPTO'18?
-	vector<Ctxt> ctxt_frob(d-1, ctxt_x);
+	// Key switching hoisting (Halevi-Shoup, CRYPTO'18): the digit decomposition of
+	// ctxt_x is computed once and shared by all d-1 Frobenius maps
+	long m = m_context.getM();
+	long key_id = ctxt_x.getKeyID();
+	unique_ptr<BasicAutomorphPrecon> precon;
+	if (hoisted)
+	{
+		precon = make_unique<BasicAutomorphPrecon>(ctxt_x);
+	}
+
+	vector<Ctxt> ctxt_frob;
+	ctxt_frob.reserve(d-1);
 	for(long iFrob = 1; iFrob < d; iFrob++)
 	{
-		ctxt_frob[iFrob-1].frobeniusAutomorph(iFrob);
+		long val = PowerMod(m_context.getP() % m, iFrob, m);
+		if (precon && ctxt_x.getPubKey().haveKeySWmatrix(1, val, key_id, key_id))
+		{
+			ctxt_frob.push_back(*precon->automorph(val));
+		}
+		else
+		{
+			// no direct key-switching matrix, frobeniusAutomorph finds a path
+			ctxt_frob.push_back(ctxt_x);
+			ctxt_frob.back().frobeniusAutomorph(iFrob);
+		}
 	} 
 
 	for(long iCoef = 0; iCoef < m_slotDeg; iCoef++)
@@ -680,12 +715,15 @@ void Comparator::extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) co
 		//cout << "Extract coefficient " << iCoef << endl;
 		Ctxt mod_p_ctxt = ctxt_x;
 
-		mod_p_ctxt.multByConstant(m_extraction_const[iCoef][0], m_extraction_const_size[iCoef][0]);
+		double const_size;
+		const DoubleCRT& const_crt = get_constant(const_size, m_num_masks + iCoef * d);
+		mod_p_ctxt.multByConstant(const_crt, const_size);
 
 		for(long iFrob = 1; iFrob < d; iFrob++)
 		{
 			Ctxt tmp = ctxt_frob[iFrob-1];
-			tmp.multByConstant(m_extraction_const[iCoef][iFrob], m_extraction_const_size[iCoef][iFrob]);
+			const DoubleCRT& frob_crt = get_constant(const_size, m_num_masks + iCoef * d + iFrob);
+			tmp.multByConstant(frob_crt, const_size);
 			mod_p_ctxt += tmp; 
 		}
 		mod_p_coefs.push_back(mod_p_ctxt);
@@ -703,15 +741,66 @@ Comparator::Comparator(const Context& context, CircuitType type, unsigned long d
 		throw invalid_argument("Field extension must be larger than the order of the plaintext modulus\n");
 	}
 
-	create_all_shift_masks();
+	m_num_masks = 0;
+	for (unsigned long shift = 1; shift < m_expansionLen; shift <<= 1)
+	{
+		m_num_masks++;
+	}
+
+	// Contexts with the same m, p, r but other generators lay out their slots differently
+	const PAlgebra& zMStar = context.getZMStar();
+	vector<int64_t> generators;
+	for (long i = 0; i < zMStar.numOfGens(); i++)
+	{
+		generators.push_back(zMStar.ZmStarGen(i));
+		generators.push_back(zMStar.OrderOf(i));
+		generators.push_back(zMStar.SameOrd(i));
+	}
+
+	ComparatorCache::Key key = {context.getM(), context.getP(), context.getR(), (int64_t)d, (int64_t)expansion_len, (int64_t)type, ComparatorCache::layoutHash(generators)};
+	string cache_path = ComparatorCache::path(getProjectRootPath() + "/data", key);
+	bool cached = m_cache.open(cache_path, key);
+
 	create_poly();
-	extraction_init();
+
+	if (!cached)
+	{
+		vector<ZZX> constants;
+		vector<double> sizes;
+		create_all_shift_masks(constants, sizes);
+		extraction_init(constants, sizes);
+
+		// the odd coefficients of LT(z) are the polynomial_U_<p>.txt coefficients
+		ZZX less_poly;
+		for (long i = 1; i <= deg(m_univar_less_full); i += 2)
+		{
+			SetCoeff(less_poly, i >> 1, coeff(m_univar_less_full, i));
+		}
+		m_cache.create(cache_path, key, context.getPhiM(), less_poly, constants, sizes);
+	}
+
+	m_constants.resize(m_cache.numConstants());
+}
+
+const DoubleCRT& Comparator::get_constant(double& size, long index) const
+{
+	lock_guard<mutex> lock(m_constants_mutex);
+	if (!m_constants[index])
+	{
+		m_constants[index] = make_shared<const DoubleCRT>(m_cache.constant(index), m_context, m_context.allPrimes());
+	}
+	size = m_cache.constantSize(index);
+	return *m_constants[index];
 }
 
 const DoubleCRT& Comparator::get_mask(double& size, long index) const
 {
-	size = m_mulMasksSize[index];
-	return m_mulMasks[index];
+	return get_constant(size, index);
+}
+
+void Comparator::set_thread_pool(shared_ptr<ThreadPool> pool)
+{
+	m_pool = pool;
 }
 
 const ZZX& Comparator::get_less_than_poly() const
@@ -1055,20 +1144,32 @@ void Comparator::evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt
 	  	Ctxt x2 = x;
 	  	x2.square();
 
+		ThreadPool* pool = m_pool.get();
+		long spawn_depth = polyEvalSpawnDepth(pool);
+
 		DynamicCtxtPowers babyStep(x2, m_bs_num_comp);
+		if (pool != nullptr)
+		{
+			computePowersParallel(babyStep, m_bs_num_comp, *pool);
+		}
 		const Ctxt& x2k = babyStep.getPower(m_bs_num_comp);
 
 		DynamicCtxtPowers giantStep(x2k, m_gs_num_comp);
+		// the parallel branches only read giant steps, the powers of two are computed here
+		for (long i = 1; pool != nullptr && i <= m_gs_num_comp; i *= 2)
+		{
+			giantStep.getPower(i);
+		}
 
 		// Special case when #giant_steps is a power of two
 		if (m_gs_num_comp == (1L << NextPowerOfTwo(m_gs_num_comp))) 
 		{
 			//cout << "I'm computing degPowerOfTwo" << endl;
-	    	degPowerOfTwo(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep);
+	    	degPowerOfTwo(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep, pool, spawn_depth);
 	    }
 	    else
 	    {
-		  	recursivePolyEval(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep);
+		  	recursivePolyEval(ret, m_univar_less_poly, m_bs_num_comp, babyStep, giantStep, pool, spawn_depth);
 
 		  	if (!IsOne(m_top_coef_comp)) 
 		  	{
@@ -1468,6 +1569,110 @@ void Comparator::compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ptxt<BGV>& pt
     HELIB_NTIMER_STOP(Comparison);
 }
 
+// g(x) = f(x - c) over F_p with one convolution, valid as long as deg(f) < p
+static void shift_poly(ZZ_pX& g, const ZZ_pX& f, long c)
+{
+	long n = deg(f);
+	clear(g);
+	if (n < 0)
+	{
+		return;
+	}
+
+	vector<ZZ_p> fact(n + 1);
+	vector<ZZ_p> inv_fact(n + 1);
+	fact[0] = 1;
+	for (long i = 1; i <= n; i++)
+	{
+		fact[i] = fact[i - 1] * i;
+	}
+	inv_fact[n] = inv(fact[n]);
+	for (long i = n; i > 0; i--)
+	{
+		inv_fact[i - 1] = inv_fact[i] * i;
+	}
+
+	// coefficient j of g is (1/j!) sum_k (f_k k!) ((-c)^{k-j} / (k-j)!)
+	ZZ_pX a, b;
+	ZZ_p neg_c = conv<ZZ_p>(-c);
+	ZZ_p neg_c_pow = conv<ZZ_p>(1);
+	for (long i = 0; i <= n; i++)
+	{
+		SetCoeff(a, n - i, coeff(f, i) * fact[i]);
+		SetCoeff(b, i, neg_c_pow * inv_fact[i]);
+		neg_c_pow *= neg_c;
+	}
+
+	ZZ_pX prod = a * b;
+	for (long j = 0; j <= n; j++)
+	{
+		SetCoeff(g, j, coeff(prod, n - j) * inv_fact[j]);
+	}
+}
+
+const ZZX& Comparator::get_range_poly(long lo, long hi) const
+{
+	lock_guard<mutex> lock(m_range_mutex);
+
+	pair<long, long> key(lo, hi);
+	auto it = m_range_polys.find(key);
+	if (it != m_range_polys.end())
+	{
+		return it->second;
+	}
+
+	ZZ_pPush push(ZZ(m_context.getP()));
+
+	ZZ_pX less_poly = conv<ZZ_pX>(m_univar_less_full);
+	ZZ_pX less_hi, less_lo;
+	shift_poly(less_hi, less_poly, hi);
+	shift_poly(less_lo, less_poly, lo);
+
+	// x < lo implies x < hi, so [lo <= x < hi] = LT(x - hi) - LT(x - lo)
+	ZZX range_poly = conv<ZZX>(less_hi - less_lo);
+	return m_range_polys.emplace(key, range_poly).first->second;
+}
+
+void Comparator::in_range(Ctxt& ctxt_res, const Ctxt& ctxt_x, long lo, long hi) const
+{
+	if (lo >= hi)
+	{
+		ctxt_res = Ctxt(ctxt_x.getPubKey());
+		return;
+	}
+
+	HELIB_NTIMER_START(RangeComparison);
+
+	// With one digit per slot the interval test is a single polynomial in x: one
+	// power basis instead of two, and no product of the two bounds.
+	if (m_type == UNI && m_slotDeg == 1 && m_expansionLen == 1)
+	{
+		parallelPolyEval(ctxt_res, get_range_poly(lo, hi), ctxt_x, m_pool.get());
+		HELIB_NTIMER_STOP(RangeComparison);
+		return;
+	}
+
+	const EncryptedArray& ea = m_context.getEA();
+	Ptxt<BGV> ptxt_lo(m_context);
+	Ptxt<BGV> ptxt_hi(m_context);
+	for (long i = 0; i < ea.size(); i++)
+	{
+		ptxt_lo[i] = lo;
+		ptxt_hi[i] = hi;
+	}
+
+	Ctxt ctxt_lo(ctxt_x.getPubKey());
+	compare(ctxt_lo, ctxt_x, ptxt_lo);
+	compare(ctxt_res, ctxt_x, ptxt_hi);
+
+	// (1 - [x < lo]) * [x < hi]
+	ctxt_lo.negate();
+	ctxt_lo.addConstant(ZZ(1));
+	ctxt_res.multiplyBy(ctxt_lo);
+
+	HELIB_NTIMER_STOP(RangeComparison);
+}
+
 void Comparator::min_max_digit(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const
 {
 }
@@ -9,6 +9,10 @@ Comparator class: creates all auxiliary information necessary to compare integer
 #include <helib/norms.h>
 #include <NTL/mat_ZZ.h>
 #include <cstdlib>  
+#include <map>
+#include <mutex>
+#include "thread_pool.hpp"
+#include "comparator_cache.hpp"
 
 using namespace std;
 using namespace NTL;
@@ -28,11 +32,15 @@ class Comparator{
   	// expansion length
   	unsigned long m_expansionLen;
 
-  	// vector of multiplicative masks
-  	vector<DoubleCRT> m_mulMasks;
+    // precomputed masks, extraction constants and less-than polynomial (mapped from data/)
+    ComparatorCache m_cache;
 
-    // vector of multiplicative mask size
-    vector<double> m_mulMasksSize;
+    // number of multiplicative masks, they come first in the cache
+    long m_num_masks;
+
+    // plaintext constants of the cache converted to DoubleCRT on first use
+    mutable vector<shared_ptr<const DoubleCRT>> m_constants;
+    mutable mutex m_constants_mutex;
 
     // univariate or bivariate circuit
     CircuitType m_type;
@@ -43,6 +51,13 @@ class Comparator{
     // univariate comparison polynomial of the less-than function
     ZZX m_univar_min_max_poly;
 
+    // full less-than polynomial LT(z) in z, before the Patterson-Stockmeyer rewriting
+    ZZX m_univar_less_full;
+
+    // cache of interval polynomials LT(x - hi) - LT(x - lo), keyed by (lo, hi)
+    mutable map<pair<long, long>, ZZX> m_range_polys;
+    mutable mutex m_range_mutex;
+
     // bivariate comparison polynomial coefficients of the less-than function
     mat_ZZ m_bivar_less_coefs; 
 
@@ -73,16 +88,18 @@ class Comparator{
     // public key
     PubKey m_pk;
 
-    // elements of F_{p^d} for extraction of F_p elements
-    vector<vector<DoubleCRT>> m_extraction_const;
-    vector<vector<double>> m_extraction_const_size;
+    // elements of F_{p^d} for extraction of F_p elements are cache constants
+    // m_num_masks + iCoef * ord_p + iFrob
 
   	// print/hide flag for debugging
   	bool m_verbose;
 
+    // pool for the Paterson-Stockmeyer branches of one comparison, null runs them serially
+    shared_ptr<ThreadPool> m_pool;
+
     // create multiplicative masks for shifts
-  	DoubleCRT create_shift_mask(double& size, long shift);
-  	void create_all_shift_masks();
+  	ZZX create_shift_mask(double& size, long shift);
+  	void create_all_shift_masks(vector<ZZX>& constants, vector<double>& sizes);
 
     // compute Patterson-Stockmeyer parameters to evaluate the comparison polynomial
     void compute_poly_params();
@@ -90,11 +107,14 @@ class Comparator{
     // create the comparison polynomial
     void create_poly();
 
+    // read polynomial_U_<p>.txt or compute the less-than coefficients
+    void load_less_poly();
+
     // initialize extraction constants
-    void extraction_init();
+    void extraction_init(vector<ZZX>& constants, vector<double>& sizes);
 
-    // extract F_p elements from slots
-    void extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x) const; 
+    // cache constant index as a DoubleCRT, built on first use
+    const DoubleCRT& get_constant(double& size, long index) const;
 
     // shifts ciphertext slots to the left by shift within batches of size m_expansionLen starting at start. Slots shifted outside their respective batches are zeroized.
     void batch_shift(Ctxt& ctxt, long start, long shift) const;
@@ -112,6 +132,9 @@ class Comparator{
     // if pow = 1, this map operates on elements of the prime field F_p
     void mapTo01_subfield(Ctxt& ctxt, long pow) const;
 
+    // interval polynomial of [lo, hi) in x
+    const ZZX& get_range_poly(long lo, long hi) const;
+
     // univariate comparison polynomial evaluation
     void evaluate_univar_less_poly(Ctxt& ret, Ctxt& ctxt_p_1, const Ctxt& x) const;
 
@@ -162,12 +185,22 @@ public:
   const ZZX& get_less_than_poly() const;
   const ZZX& get_min_max_poly() const;
 
+  // run the polynomial evaluation inside each comparison on pool (null = serially);
+  // not to be changed while comparisons are running
+  void set_thread_pool(shared_ptr<ThreadPool> pool);
+
   // decrypt and print ciphertext
   void print_decrypted(const Ctxt& ctxt) const;
 
+  // extract F_p elements from slots; hoisted applies all Frobenius maps from one key-switching decomposition
+  void extract_mod_p(vector<Ctxt>& mod_p_coefs, const Ctxt& ctxt_x, bool hoisted = true) const;
+
   // comparison function
   void compare(Ctxt& ctxt_res, const Ctxt& ctxt_x, const Ptxt<BGV>& ptxt_y) const;
 
+  // interval test: 1 in the slots where lo <= x < hi, 0 elsewhere
+  void in_range(Ctxt& ctxt_res, const Ctxt& ctxt_x, long lo, long hi) const;
+
   // minimum/maximum function for general vectors
   void min_max(Ctxt& ctxt_min, Ctxt& ctxt_max, const Ctxt& ctxt_x, const Ctxt& ctxt_y) const;
 
@@ -0,0 +1,188 @@
+#include "comparator_cache.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char CACHE_MAGIC[8] = {'S', 'Q', 'U', 'I', 'D', 'C', 'M', 'P'};
+
+ComparatorCache::~ComparatorCache()
+{
+    close();
+}
+
+void ComparatorCache::close()
+{
+    if (mapped)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+    data = nullptr;
+    length = 0;
+    mapped = false;
+    buffer.clear();
+}
+
+string ComparatorCache::path(const string &directory, const Key &key)
+{
+    char layout[17];
+    snprintf(layout, sizeof(layout), "%016llx", (unsigned long long)key.layout);
+    return directory + "/comparator_" + to_string(key.m) + "_" + to_string(key.p) + "_" + to_string(key.r) + "_" +
+           to_string(key.d) + "_" + to_string(key.expansion_len) + "_" + to_string(key.type) + "_" + layout + ".bin";
+}
+
+int64_t ComparatorCache::layoutHash(const vector<int64_t> &generators)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int64_t value : generators)
+    {
+        for (int byte = 0; byte < 8; byte++)
+        {
+            hash ^= (uint64_t(value) >> (8 * byte)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    return int64_t(hash);
+}
+
+bool ComparatorCache::open(const string &path, const Key &key)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    data = static_cast<const char *>(map);
+    length = st.st_size;
+    mapped = true;
+
+    // Anything that does not match exactly is rebuilt by the caller
+    Header h;
+    memcpy(&h, data, sizeof(Header));
+    size_t expected = sizeof(Header) + h.poly_len * sizeof(int64_t) + h.num_constants * (sizeof(double) + h.phi_m * sizeof(int64_t));
+    if (memcmp(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || h.version != COMPARATOR_CACHE_VERSION ||
+        memcmp(&h.key, &key, sizeof(Key)) != 0 || h.poly_len < 0 || h.num_constants < 0 || h.phi_m <= 0 ||
+        expected != length)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ComparatorCache::create(const string &path, const Key &key, long phi_m, const NTL::ZZX &less_poly, const vector<NTL::ZZX> &constants, const vector<double> &sizes)
+{
+    close();
+
+    Header h;
+    memset(&h, 0, sizeof(Header));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    h.version = COMPARATOR_CACHE_VERSION;
+    h.key = key;
+    h.phi_m = phi_m;
+    h.poly_len = NTL::deg(less_poly) + 1;
+    h.num_constants = constants.size();
+
+    string bytes;
+    bytes.reserve(sizeof(Header) + h.poly_len * sizeof(int64_t) + h.num_constants * (sizeof(double) + phi_m * sizeof(int64_t)));
+    bytes.append(reinterpret_cast<const char *>(&h), sizeof(Header));
+
+    for (long i = 0; i < h.poly_len; i++)
+    {
+        int64_t coef = NTL::conv<long>(NTL::coeff(less_poly, i));
+        bytes.append(reinterpret_cast<const char *>(&coef), sizeof(int64_t));
+    }
+    for (size_t c = 0; c < constants.size(); c++)
+    {
+        bytes.append(reinterpret_cast<const char *>(&sizes[c]), sizeof(double));
+        for (long i = 0; i < phi_m; i++)
+        {
+            int64_t coef = NTL::conv<long>(NTL::coeff(constants[c], i));
+            bytes.append(reinterpret_cast<const char *>(&coef), sizeof(int64_t));
+        }
+    }
+
+    // Written next to the target and renamed, so a concurrent start never maps a partial file
+    string tmp_path = path + ".tmp" + to_string(getpid());
+    ofstream out(tmp_path, ios::binary);
+    out.write(bytes.data(), bytes.size());
+    out.close();
+    if (out && rename(tmp_path.c_str(), path.c_str()) == 0 && open(path, key))
+    {
+        return;
+    }
+    remove(tmp_path.c_str());
+
+    buffer = std::move(bytes);
+    data = buffer.data();
+    length = buffer.size();
+}
+
+const char *ComparatorCache::record(long index) const
+{
+    const Header &h = header();
+    return data + sizeof(Header) + h.poly_len * sizeof(int64_t) + index * (sizeof(double) + h.phi_m * sizeof(int64_t));
+}
+
+NTL::ZZX ComparatorCache::lessPoly() const
+{
+    NTL::ZZX poly;
+    const char *coefs = data + sizeof(Header);
+    for (long i = 0; i < header().poly_len; i++)
+    {
+        int64_t coef;
+        memcpy(&coef, coefs + i * sizeof(int64_t), sizeof(int64_t));
+        NTL::SetCoeff(poly, i, coef);
+    }
+    return poly;
+}
+
+long ComparatorCache::numConstants() const
+{
+    return header().num_constants;
+}
+
+double ComparatorCache::constantSize(long index) const
+{
+    double size;
+    memcpy(&size, record(index), sizeof(double));
+    return size;
+}
+
+NTL::ZZX ComparatorCache::constant(long index) const
+{
+    NTL::ZZX poly;
+    const char *coefs = record(index) + sizeof(double);
+    long phi_m = header().phi_m;
+    poly.SetLength(phi_m);
+    for (long i = 0; i < phi_m; i++)
+    {
+        int64_t coef;
+        memcpy(&coef, coefs + i * sizeof(int64_t), sizeof(int64_t));
+        poly[i] = coef;
+    }
+    poly.normalize();
+    return poly;
+}
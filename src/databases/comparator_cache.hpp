@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <NTL/ZZX.h>
+
+using namespace std;
+
+#define COMPARATOR_CACHE_VERSION 2
+
+// Versioned binary cache of the comparator precomputation, memory-mapped read-only.
+// Layout: Header, the less-than polynomial coefficients (int64), then one record per
+// plaintext constant (shift masks first, then the extraction constants): its size
+// as a double followed by phi(m) int64 coefficients.
+class ComparatorCache
+{
+public:
+    struct Key
+    {
+        int64_t m, p, r, d, expansion_len, type;
+        // Hash of the Z_m^* generators and orders, the masks depend on the slot layout
+        int64_t layout;
+    };
+
+    ComparatorCache() = default;
+    ~ComparatorCache();
+
+    ComparatorCache(const ComparatorCache &) = delete;
+    ComparatorCache &operator=(const ComparatorCache &) = delete;
+
+    // False when the file is missing, was written for other parameters or is truncated
+    bool open(const string &path, const Key &key);
+    // Writes a new cache file and opens it; keeps the bytes in memory if the file cannot be written
+    void create(const string &path, const Key &key, long phi_m, const NTL::ZZX &less_poly, const vector<NTL::ZZX> &constants, const vector<double> &sizes);
+
+    bool isOpen() const { return data != nullptr; }
+    NTL::ZZX lessPoly() const;
+    long numConstants() const;
+    double constantSize(long index) const;
+    NTL::ZZX constant(long index) const;
+
+    static string path(const string &directory, const Key &key);
+    // FNV-1a hash of the generators, orders and native flags of every hypercube dimension
+    static int64_t layoutHash(const vector<int64_t> &generators);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        Key key;
+        int64_t phi_m;
+        int64_t poly_len;
+        int64_t num_constants;
+    };
+
+    const char *data = nullptr;
+    size_t length = 0;
+    bool mapped = false;
+    string buffer;
+
+    const Header &header() const { return *reinterpret_cast<const Header *>(data); }
+    const char *record(long index) const;
+    void close();
+};
@@ -0,0 +1,217 @@
+#include "ctxt_cache.hpp"
+
+using namespace std;
+
+CtxtCache::CtxtCache(size_t byte_budget) : shard_budget(byte_budget / CTXT_CACHE_SHARDS)
+{
+    for (uint32_t i = 0; i < CTXT_CACHE_SHARDS; i++)
+    {
+        shards.push_back(make_unique<Shard>());
+    }
+}
+
+// kind in the top 8 bits, column in the next 32, row in the low 24
+uint64_t CtxtCache::entryKey(uint32_t kind, uint32_t column, uint32_t row)
+{
+    return (uint64_t(kind) << 56) | (uint64_t(column) << 24) | (row & 0xFFFFFF);
+}
+
+uint64_t CtxtCache::columnKey(uint32_t kind, uint32_t column)
+{
+    return (uint64_t(kind) << 32) | column;
+}
+
+CtxtCache::Shard &CtxtCache::shard(uint64_t key) const
+{
+    // Neighbouring rows and columns land on different shards
+    return *shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % CTXT_CACHE_SHARDS];
+}
+
+bool CtxtCache::isPinned(uint32_t kind, uint32_t column) const
+{
+    lock_guard<mutex> lock(pinned_mutex);
+    return pinned_columns.count(columnKey(kind, column)) > 0;
+}
+
+shared_ptr<const helib::Ctxt> CtxtCache::get(uint32_t kind, uint32_t column, uint32_t row)
+{
+    uint64_t key = entryKey(kind, column, row);
+    Shard &s = shard(key);
+
+    lock_guard<mutex> lock(s.shard_mutex);
+    auto it = s.entries.find(key);
+    if (it == s.entries.end())
+    {
+        misses.fetch_add(1);
+        return nullptr;
+    }
+    if (!it->second.pinned)
+    {
+        s.lru.splice(s.lru.begin(), s.lru, it->second.lru_position);
+    }
+    hits.fetch_add(1);
+    return it->second.ctxt;
+}
+
+bool CtxtCache::contains(uint32_t kind, uint32_t column, uint32_t row) const
+{
+    uint64_t key = entryKey(kind, column, row);
+    Shard &s = shard(key);
+
+    lock_guard<mutex> lock(s.shard_mutex);
+    return s.entries.count(key) > 0;
+}
+
+void CtxtCache::put(uint32_t kind, uint32_t column, uint32_t row, shared_ptr<const helib::Ctxt> ctxt, size_t bytes)
+{
+    bool pinned = isPinned(kind, column);
+    if (!pinned && bytes > shard_budget.load())
+    {
+        return;
+    }
+
+    uint64_t key = entryKey(kind, column, row);
+    Shard &s = shard(key);
+
+    lock_guard<mutex> lock(s.shard_mutex);
+    auto it = s.entries.find(key);
+    if (it != s.entries.end())
+    {
+        // Another thread read the same ciphertext meanwhile, keep the entry already there
+        return;
+    }
+
+    Entry entry = {std::move(ctxt), bytes, pinned, s.lru.end()};
+    if (pinned)
+    {
+        s.pinned_bytes += bytes;
+    }
+    else
+    {
+        s.lru.push_front(key);
+        entry.lru_position = s.lru.begin();
+        s.bytes += bytes;
+    }
+    s.entries.emplace(key, std::move(entry));
+    evict(s);
+}
+
+void CtxtCache::evict(Shard &s)
+{
+    size_t budget = shard_budget.load();
+    while (s.bytes > budget && !s.lru.empty())
+    {
+        uint64_t victim = s.lru.back();
+        s.lru.pop_back();
+        auto it = s.entries.find(victim);
+        s.bytes -= it->second.bytes;
+        s.entries.erase(it);
+        evictions.fetch_add(1);
+    }
+}
+
+void CtxtCache::erase(uint32_t kind, uint32_t column, uint32_t row)
+{
+    uint64_t key = entryKey(kind, column, row);
+    Shard &s = shard(key);
+
+    lock_guard<mutex> lock(s.shard_mutex);
+    auto it = s.entries.find(key);
+    if (it == s.entries.end())
+    {
+        return;
+    }
+    if (it->second.pinned)
+    {
+        s.pinned_bytes -= it->second.bytes;
+    }
+    else
+    {
+        s.lru.erase(it->second.lru_position);
+        s.bytes -= it->second.bytes;
+    }
+    s.entries.erase(it);
+}
+
+void CtxtCache::clear()
+{
+    for (auto &s : shards)
+    {
+        lock_guard<mutex> lock(s->shard_mutex);
+        s->entries.clear();
+        s->lru.clear();
+        s->bytes = 0;
+        s->pinned_bytes = 0;
+    }
+}
+
+void CtxtCache::pin(uint32_t kind, uint32_t column)
+{
+    {
+        lock_guard<mutex> lock(pinned_mutex);
+        pinned_columns.insert(columnKey(kind, column));
+    }
+
+    // Entries of the column that are already cached leave the LRU list
+    for (auto &s : shards)
+    {
+        lock_guard<mutex> lock(s->shard_mutex);
+        for (auto &[key, entry] : s->entries)
+        {
+            if (!entry.pinned && key >> 56 == kind && ((key >> 24) & 0xFFFFFFFF) == column)
+            {
+                s->lru.erase(entry.lru_position);
+                s->bytes -= entry.bytes;
+                s->pinned_bytes += entry.bytes;
+                entry.pinned = true;
+            }
+        }
+    }
+}
+
+void CtxtCache::unpin(uint32_t kind, uint32_t column)
+{
+    {
+        lock_guard<mutex> lock(pinned_mutex);
+        pinned_columns.erase(columnKey(kind, column));
+    }
+
+    for (auto &s : shards)
+    {
+        lock_guard<mutex> lock(s->shard_mutex);
+        for (auto &[key, entry] : s->entries)
+        {
+            if (entry.pinned && key >> 56 == kind && ((key >> 24) & 0xFFFFFFFF) == column)
+            {
+                s->lru.push_back(key);
+                entry.lru_position = prev(s->lru.end());
+                s->pinned_bytes -= entry.bytes;
+                s->bytes += entry.bytes;
+                entry.pinned = false;
+            }
+        }
+        evict(*s);
+    }
+}
+
+void CtxtCache::setBudget(size_t byte_budget)
+{
+    shard_budget = byte_budget / CTXT_CACHE_SHARDS;
+    for (auto &s : shards)
+    {
+        lock_guard<mutex> lock(s->shard_mutex);
+        evict(*s);
+    }
+}
+
+CtxtCache::Stats CtxtCache::stats() const
+{
+    Stats result = {hits.load(), misses.load(), evictions.load(), 0, 0};
+    for (auto &s : shards)
+    {
+        lock_guard<mutex> lock(s->shard_mutex);
+        result.bytes += s->bytes + s->pinned_bytes;
+        result.entries += s->entries.size();
+    }
+    return result;
+}
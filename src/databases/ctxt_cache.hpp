@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <helib/helib.h>
+
+using namespace std;
+
+#define DEFAULT_CTXT_CACHE_BYTES (size_t(1) << 30)
+#define CTXT_CACHE_SHARDS 16
+
+// Sharded LRU cache of deserialized ciphertexts, bounded by a byte budget split evenly
+// over the shards. A ciphertext is addressed by (kind, column, row), where kind tells
+// apart genotype, indicator and phenotype columns. Entries of pinned columns stay
+// resident and do not count against the budget.
+class CtxtCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t bytes;
+        size_t entries;
+    };
+
+    explicit CtxtCache(size_t byte_budget = DEFAULT_CTXT_CACHE_BYTES);
+
+    CtxtCache(const CtxtCache &) = delete;
+    CtxtCache &operator=(const CtxtCache &) = delete;
+
+    // nullptr on a miss
+    shared_ptr<const helib::Ctxt> get(uint32_t kind, uint32_t column, uint32_t row);
+    // Unlike get, neither counts a hit or miss nor refreshes the entry
+    bool contains(uint32_t kind, uint32_t column, uint32_t row) const;
+    void put(uint32_t kind, uint32_t column, uint32_t row, shared_ptr<const helib::Ctxt> ctxt, size_t bytes);
+    void erase(uint32_t kind, uint32_t column, uint32_t row);
+    void clear();
+
+    void pin(uint32_t kind, uint32_t column);
+    void unpin(uint32_t kind, uint32_t column);
+
+    // A budget of 0 disables the cache
+    void setBudget(size_t byte_budget);
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        shared_ptr<const helib::Ctxt> ctxt;
+        size_t bytes;
+        bool pinned;
+        list<uint64_t>::iterator lru_position;
+    };
+
+    struct Shard
+    {
+        mutable mutex shard_mutex;
+        unordered_map<uint64_t, Entry> entries;
+        // Most recently used first, pinned entries are not in the list
+        list<uint64_t> lru;
+        size_t bytes = 0;
+        size_t pinned_bytes = 0;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    atomic<size_t> shard_budget;
+
+    mutable mutex pinned_mutex;
+    unordered_set<uint64_t> pinned_columns;
+
+    atomic<uint64_t> hits{0};
+    atomic<uint64_t> misses{0};
+    atomic<uint64_t> evictions{0};
+
+    static uint64_t entryKey(uint32_t kind, uint32_t column, uint32_t row);
+    static uint64_t columnKey(uint32_t kind, uint32_t column);
+    Shard &shard(uint64_t key) const;
+    bool isPinned(uint32_t kind, uint32_t column) const;
+    void evict(Shard &s);
+};
@@ -0,0 +1,114 @@
+#include "ctxt_codec.hpp"
+#include "mapped_stream.hpp"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+static const char CTXT_CODEC_MAGIC[8] = {'S', 'Q', 'U', 'I', 'D', 'C', 'T', 'X'};
+
+struct BatchHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct BatchEntry
+{
+    uint64_t offset;
+    uint64_t length;
+    int64_t level;
+    int64_t key_id;
+};
+
+bool isCtxtBatch(const char *data, size_t size)
+{
+    return size >= sizeof(BatchHeader) && memcmp(data, CTXT_CODEC_MAGIC, sizeof(CTXT_CODEC_MAGIC)) == 0;
+}
+
+string encodeCtxtBatch(const vector<helib::Ctxt> &ctxts)
+{
+    vector<string> payloads = vector<string>();
+    for (const helib::Ctxt &ctxt : ctxts)
+    {
+        ostringstream out;
+        ctxt.writeTo(out);
+        payloads.push_back(out.str());
+    }
+
+    BatchHeader h;
+    memset(&h, 0, sizeof(BatchHeader));
+    memcpy(h.magic, CTXT_CODEC_MAGIC, sizeof(CTXT_CODEC_MAGIC));
+    h.version = CTXT_CODEC_VERSION;
+    h.count = ctxts.size();
+
+    string bytes;
+    bytes.append(reinterpret_cast<const char *>(&h), sizeof(BatchHeader));
+
+    uint64_t offset = sizeof(BatchHeader) + ctxts.size() * sizeof(BatchEntry);
+    for (size_t i = 0; i < ctxts.size(); i++)
+    {
+        BatchEntry e = {offset, payloads[i].size(), ctxts[i].getPrimeSet().card(), ctxts[i].getKeyID()};
+        bytes.append(reinterpret_cast<const char *>(&e), sizeof(BatchEntry));
+        offset += payloads[i].size();
+    }
+    for (const string &payload : payloads)
+    {
+        bytes.append(payload);
+    }
+    return bytes;
+}
+
+vector<helib::Ctxt> decodeCtxtBatch(const char *data, size_t size, const helib::PubKey &public_key, ThreadPool *pool)
+{
+    if (!isCtxtBatch(data, size))
+    {
+        throw invalid_argument("ERROR: not a ciphertext batch");
+    }
+
+    BatchHeader h;
+    memcpy(&h, data, sizeof(BatchHeader));
+    if (h.version != CTXT_CODEC_VERSION || h.count > (size - sizeof(BatchHeader)) / sizeof(BatchEntry))
+    {
+        throw invalid_argument("ERROR: unsupported or truncated ciphertext batch");
+    }
+
+    vector<BatchEntry> entries(h.count);
+    memcpy(entries.data(), data + sizeof(BatchHeader), h.count * sizeof(BatchEntry));
+    for (const BatchEntry &e : entries)
+    {
+        if (e.offset > size || e.length > size - e.offset)
+        {
+            throw invalid_argument("ERROR: truncated ciphertext batch");
+        }
+    }
+
+    vector<helib::Ctxt> ctxts = vector<helib::Ctxt>(h.count, helib::Ctxt(public_key));
+    auto decode = [&](size_t i)
+    {
+        MappedStreamBuf buf(data + entries[i].offset, entries[i].length);
+        istream in(&buf);
+        ctxts[i] = helib::Ctxt::readFrom(in, public_key);
+        if (ctxts[i].getPrimeSet().card() != entries[i].level || ctxts[i].getKeyID() != entries[i].key_id)
+        {
+            throw invalid_argument("ERROR: ciphertext does not match its batch header");
+        }
+    };
+
+    if (pool != nullptr)
+    {
+        pool->parallelFor(0, h.count, decode);
+    }
+    else
+    {
+        for (size_t i = 0; i < h.count; i++)
+        {
+            decode(i);
+        }
+    }
+    return ctxts;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <helib/helib.h>
+#include "thread_pool.hpp"
+
+using namespace std;
+
+#define CTXT_CODEC_VERSION 1
+
+// Binary encoding of a batch of ciphertexts for the wire. A table in front records offset,
+// length, level (number of primes) and key ID of every ciphertext, followed by the HElib
+// binary serializations, which keep the DoubleCRT limbs as raw 64-bit words. With the
+// offsets known up front the ciphertexts are decoded in parallel straight from the buffer,
+// instead of walking a JSON document one ciphertext after the other.
+bool isCtxtBatch(const char *data, size_t size);
+string encodeCtxtBatch(const vector<helib::Ctxt> &ctxts);
+// Throws invalid_argument on a malformed batch or one whose header does not match its contents
+vector<helib::Ctxt> decodeCtxtBatch(const char *data, size_t size, const helib::PubKey &public_key, ThreadPool *pool = nullptr);
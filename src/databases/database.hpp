@@ -2,8 +2,18 @@
 
 #include <vector>
 #include <string>
+#include <random>
 
 using namespace std;
+
+// Random stream of one column for the gen*Data loaders. Columns do not share a stream, so
+// they can be generated in any order and every database type gets the same values for a seed.
+inline mt19937 columnGenerator(uint32_t seed, uint32_t column)
+{
+    seed_seq seq{seed, column};
+    return mt19937(seq);
+}
+
 template <typename T, typename R>
 class Database
 {
@@ -0,0 +1,157 @@
+#include "key_store.hpp"
+#include "mapped_stream.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char KEY_STORE_MAGIC[8] = {'S', 'Q', 'U', 'I', 'D', 'K', 'E', 'Y'};
+
+KeyStore::~KeyStore()
+{
+    close();
+}
+
+void KeyStore::close()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+    data = nullptr;
+    length = 0;
+}
+
+bool KeyStore::open(const string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+    data = static_cast<const char *>(map);
+    length = st.st_size;
+
+    Header h;
+    memcpy(&h, data, sizeof(Header));
+    bool valid = memcmp(h.magic, KEY_STORE_MAGIC, sizeof(KEY_STORE_MAGIC)) == 0 && h.version == KEY_STORE_VERSION && h.lengths[CONTEXT] > 0;
+    for (int s = 0; s < NUM_SECTIONS && valid; s++)
+    {
+        valid = h.offsets[s] <= length && h.lengths[s] <= length - h.offsets[s];
+    }
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool KeyStore::has(Section section) const
+{
+    return isOpen() && header().lengths[section] > 0;
+}
+
+const char *KeyStore::section(Section section, size_t &section_length) const
+{
+    if (!has(section))
+    {
+        throw invalid_argument("ERROR: key store has no such section");
+    }
+    section_length = header().lengths[section];
+    return data + header().offsets[section];
+}
+
+helib::Context KeyStore::readContext() const
+{
+    size_t size;
+    const char *begin = section(CONTEXT, size);
+    MappedStreamBuf buf(begin, size);
+    istream in(&buf);
+    return helib::Context::readFrom(in);
+}
+
+helib::PubKey KeyStore::readPubKey(const helib::Context &context) const
+{
+    size_t size;
+    const char *begin = section(PUBLIC_KEY, size);
+    MappedStreamBuf buf(begin, size);
+    istream in(&buf);
+    return helib::PubKey::readFrom(in, context);
+}
+
+helib::SecKey KeyStore::readSecKey(const helib::Context &context) const
+{
+    size_t size;
+    const char *begin = section(SECRET_KEY, size);
+    MappedStreamBuf buf(begin, size);
+    istream in(&buf);
+    return helib::SecKey::readFrom(in, context);
+}
+
+void KeyStore::write(const string &path, const helib::Context &context, const helib::PubKey *public_key, const helib::SecKey *secret_key)
+{
+    ostringstream sections[NUM_SECTIONS];
+    context.writeTo(sections[CONTEXT]);
+    if (public_key != nullptr)
+    {
+        public_key->writeTo(sections[PUBLIC_KEY]);
+    }
+    if (secret_key != nullptr)
+    {
+        secret_key->writeTo(sections[SECRET_KEY]);
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(Header));
+    memcpy(h.magic, KEY_STORE_MAGIC, sizeof(KEY_STORE_MAGIC));
+    h.version = KEY_STORE_VERSION;
+    uint64_t offset = sizeof(Header);
+    for (int s = 0; s < NUM_SECTIONS; s++)
+    {
+        h.offsets[s] = offset;
+        h.lengths[s] = sections[s].tellp();
+        offset += h.lengths[s];
+    }
+
+    // Written next to the target and renamed, so a concurrent reader never maps a partial file
+    string tmp_path = path + ".tmp" + to_string(getpid());
+    ofstream out(tmp_path, ios::binary);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(Header));
+    for (int s = 0; s < NUM_SECTIONS; s++)
+    {
+        string bytes = sections[s].str();
+        out.write(bytes.data(), bytes.size());
+    }
+    out.close();
+    if (!out || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp_path.c_str());
+        throw runtime_error("Cannot write key store " + path);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <helib/helib.h>
+
+using namespace std;
+
+#define KEY_STORE_VERSION 1
+
+// Single-file binary store of a context and its keys, memory-mapped read-only so that
+// processes loading the same store share its pages. Layout: Header, then the HElib
+// binary serialization of every section present. The key sections carry the
+// key-switching (relinearization, rotation and Frobenius) matrices of the key.
+class KeyStore
+{
+public:
+    enum Section
+    {
+        CONTEXT = 0,
+        PUBLIC_KEY = 1,
+        SECRET_KEY = 2,
+        NUM_SECTIONS = 3
+    };
+
+    KeyStore() = default;
+    ~KeyStore();
+
+    KeyStore(const KeyStore &) = delete;
+    KeyStore &operator=(const KeyStore &) = delete;
+
+    // False when the file is missing, has another version or is truncated
+    bool open(const string &path);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    bool has(Section section) const;
+
+    helib::Context readContext() const;
+    helib::PubKey readPubKey(const helib::Context &context) const;
+    helib::SecKey readSecKey(const helib::Context &context) const;
+
+    // Keys are optional, pass nullptr to leave a section out
+    static void write(const string &path, const helib::Context &context, const helib::PubKey *public_key, const helib::SecKey *secret_key);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t offsets[NUM_SECTIONS];
+        uint64_t lengths[NUM_SECTIONS];
+    };
+
+    const char *data = nullptr;
+    size_t length = 0;
+
+    const Header &header() const { return *reinterpret_cast<const Header *>(data); }
+    const char *section(Section section, size_t &section_length) const;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <streambuf>
+#include <cstddef>
+
+using namespace std;
+
+// Read-only stream buffer over mapped bytes, so HElib parses straight from the mapped pages
+struct MappedStreamBuf : public streambuf
+{
+    MappedStreamBuf(const char *begin, size_t size)
+    {
+        char *p = const_cast<char *>(begin);
+        setg(p, p, p + size);
+    }
+};
@@ -10,12 +10,11 @@ void PlaintextDatabase::genData(uint32_t _num_rows, uint32_t _num_snp_cols, uint
     num_snp_cols = _num_snp_cols;
     num_compressed_rows = num_rows;
 
-    random_device rd;
-    mt19937 gen(seed);
     uniform_int_distribution<> dis(0, 2);
 
     for (size_t i = 0; i < snp_data.size(); ++i)
     {
+        mt19937 gen = columnGenerator(seed, i);
         for (size_t j = 0; j < snp_data[i].size(); ++j)
         {
             snp_data[i][j] = dis(gen);
@@ -31,12 +30,11 @@ void PlaintextDatabase::genContinuousPhenoData(uint32_t num_continuous_pheno_col
 
     continuous_phenotype_data.resize(num_continuous_pheno_cols, vector<int32_t>(num_rows, 0));
 
-    random_device rd;
-    mt19937 gen(seed);
     uniform_int_distribution<> dis(low, high);
 
     for (size_t i = 0; i < continuous_phenotype_data.size(); ++i)
     {
+        mt19937 gen = columnGenerator(seed, i);
         for (size_t j = 0; j < continuous_phenotype_data[i].size(); ++j)
         {
             continuous_phenotype_data[i][j] = dis(gen);
@@ -52,12 +50,11 @@ void PlaintextDatabase::genBinaryPhenoData(uint32_t num_binary_pheno_cols, uint3
 
     binary_phenotype_data.resize(num_binary_pheno_cols, vector<int32_t>(num_rows, 0));
 
-    random_device rd;
-    mt19937 gen(seed);
     uniform_int_distribution<> dis(0, 1);
 
     for (size_t i = 0; i < binary_phenotype_data.size(); ++i)
     {
+        mt19937 gen = columnGenerator(seed, i);
         for (size_t j = 0; j < binary_phenotype_data[i].size(); ++j)
         {
             binary_phenotype_data[i][j] = dis(gen);
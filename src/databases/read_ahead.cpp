@@ -0,0 +1,137 @@
+#include "read_ahead.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+ReadAhead::ReadAhead(Loader _loader, uint32_t num_threads, size_t _window) : loader(std::move(_loader)), window(max<size_t>(_window, 1))
+{
+    for (uint32_t i = 0; i < num_threads; i++)
+    {
+        threads.emplace_back(&ReadAhead::ioLoop, this);
+    }
+}
+
+ReadAhead::~ReadAhead()
+{
+    {
+        lock_guard<mutex> lock(batches_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+uint64_t ReadAhead::itemKey(uint32_t kind, uint32_t column, uint32_t row)
+{
+    return (uint64_t(kind) << 56) | (uint64_t(column) << 24) | (row & 0xFFFFFF);
+}
+
+shared_ptr<void> ReadAhead::start(vector<Item> items)
+{
+    if (threads.empty() || items.empty())
+    {
+        return nullptr;
+    }
+
+    Batch *batch = new Batch();
+    batch->items = std::move(items);
+    {
+        lock_guard<mutex> lock(batches_mutex);
+        batches.push_back(batch);
+    }
+    wake.notify_all();
+
+    return shared_ptr<void>(batch, [this](void *b)
+                            { release(static_cast<Batch *>(b)); });
+}
+
+void ReadAhead::release(Batch *batch)
+{
+    {
+        lock_guard<mutex> lock(batches_mutex);
+        outstanding -= batch->unconsumed.size();
+        batches.remove(batch);
+        // An I/O thread still loading an item of this batch only touches the cache
+    }
+    wake.notify_all();
+    delete batch;
+}
+
+void ReadAhead::consumed(uint32_t kind, uint32_t column, uint32_t row)
+{
+    uint64_t key = itemKey(kind, column, row);
+
+    lock_guard<mutex> lock(batches_mutex);
+    for (Batch *batch : batches)
+    {
+        if (batch->unconsumed.erase(key) > 0)
+        {
+            outstanding--;
+            wake.notify_one();
+        }
+        else if (batch->next < batch->items.size())
+        {
+            batch->read.insert(key);
+        }
+    }
+}
+
+void ReadAhead::ioLoop()
+{
+    while (true)
+    {
+        Item item;
+        {
+            unique_lock<mutex> lock(batches_mutex);
+            Batch *batch = nullptr;
+            wake.wait(lock, [&]
+                      {
+                if (stopping)
+                {
+                    return true;
+                }
+                if (outstanding >= window)
+                {
+                    return false;
+                }
+                // Oldest query first, skipping what its workers already read themselves
+                for (Batch *b : batches)
+                {
+                    while (b->next < b->items.size())
+                    {
+                        const Item &i = b->items[b->next];
+                        if (b->read.count(itemKey(i.kind, i.column, i.row)) == 0)
+                        {
+                            batch = b;
+                            return true;
+                        }
+                        b->next++;
+                    }
+                }
+                return false; });
+            if (stopping)
+            {
+                return;
+            }
+
+            item = batch->items[batch->next++];
+            if (batch->unconsumed.insert(itemKey(item.kind, item.column, item.row)).second)
+            {
+                outstanding++;
+            }
+        }
+
+        // A failed read is left to the consumer, which reads the item again and reports the error
+        try
+        {
+            loader(item);
+        }
+        catch (...)
+        {
+        }
+    }
+}
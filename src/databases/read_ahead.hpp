@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+using namespace std;
+
+#define DEFAULT_READ_AHEAD_THREADS 2
+#define DEFAULT_READ_AHEAD_WINDOW 32
+
+// Dedicated I/O threads that load ciphertexts ahead of the workers computing on them.
+// A query hands over the (kind, column, row) triples in the order it will read them and
+// the loader runs on each, typically putting the ciphertext into a cache. At most window
+// ciphertexts are loaded but not yet consumed, so read-ahead never runs away from compute
+// and evicts what the workers still need.
+class ReadAhead
+{
+public:
+    struct Item
+    {
+        uint32_t kind;
+        uint32_t column;
+        uint32_t row;
+    };
+    using Loader = function<void(const Item &)>;
+
+    ReadAhead(Loader loader, uint32_t num_threads = DEFAULT_READ_AHEAD_THREADS, size_t window = DEFAULT_READ_AHEAD_WINDOW);
+    ~ReadAhead();
+
+    ReadAhead(const ReadAhead &) = delete;
+    ReadAhead &operator=(const ReadAhead &) = delete;
+
+    // Read-ahead of these items stops once the returned ticket is released
+    shared_ptr<void> start(vector<Item> items);
+    // Every read of a consumer, frees a slot of the window when the item was read ahead
+    void consumed(uint32_t kind, uint32_t column, uint32_t row);
+
+private:
+    struct Batch
+    {
+        vector<Item> items;
+        size_t next = 0;
+        // Loaded and not consumed yet, and consumed before the I/O threads got to them
+        unordered_set<uint64_t> unconsumed;
+        unordered_set<uint64_t> read;
+    };
+
+    Loader loader;
+    size_t window;
+    size_t outstanding = 0;
+    bool stopping = false;
+
+    mutex batches_mutex;
+    condition_variable wake;
+    list<Batch *> batches;
+    vector<thread> threads;
+
+    static uint64_t itemKey(uint32_t kind, uint32_t column, uint32_t row);
+    void release(Batch *batch);
+    void ioLoop();
+};
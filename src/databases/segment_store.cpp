@@ -0,0 +1,425 @@
+#include "segment_store.hpp"
+#include "mapped_stream.hpp"
+
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char SEGMENT_MAGIC[8] = {'S', 'Q', 'U', 'I', 'D', 'S', 'E', 'G'};
+static const uint32_t RECORD_MAGIC = 0x43525153; // "SQRC"
+
+struct RecordHeader
+{
+    uint32_t magic;
+    uint32_t column;
+    uint32_t row;
+    uint32_t reserved;
+    uint64_t length;
+    int64_t level;
+};
+
+struct FooterEntry
+{
+    uint32_t column;
+    uint32_t row;
+    uint64_t offset;
+    uint64_t length;
+    int64_t level;
+};
+
+struct Trailer
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t footer_offset;
+    uint64_t num_entries;
+};
+
+static uint64_t entryKey(uint32_t column, uint32_t row)
+{
+    return (uint64_t(column) << 32) | row;
+}
+
+SegmentStore::Mapping::~Mapping()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+}
+
+SegmentStore::SegmentStore(const string &_directory) : directory(_directory)
+{
+    filesystem::create_directories(directory);
+}
+
+SegmentStore::~SegmentStore()
+{
+    // A footer that cannot be written is rebuilt from the records on the next open
+    try
+    {
+        flush();
+    }
+    catch (const exception &e)
+    {
+        std::cerr << "Error flushing segment files: " << e.what() << std::endl;
+    }
+    for (auto &[name, seg] : segments)
+    {
+        ::close(seg->fd);
+    }
+}
+
+SegmentStore::Segment *SegmentStore::segment(const string &kind, uint32_t column, bool create) const
+{
+    string name = kind + "_" + to_string(column / SEGMENT_COLUMNS);
+
+    lock_guard<mutex> lock(segments_mutex);
+    auto it = segments.find(name);
+    if (it != segments.end())
+    {
+        if (create && !it->second->writable)
+        {
+            lock_guard<mutex> seg_lock(it->second->segment_mutex);
+            makeWritable(*it->second);
+        }
+        return it->second.get();
+    }
+
+    // Read-only until something is written, so a database without write permission can be queried
+    string path = directory + "/" + name + ".seg";
+    int fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        if (!create && errno == ENOENT)
+        {
+            return nullptr;
+        }
+        throw runtime_error("Cannot open segment file " + path);
+    }
+
+    unique_ptr<Segment> seg = make_unique<Segment>();
+    seg->path = path;
+    seg->fd = fd;
+    seg->writable = create;
+    load(*seg);
+    return (segments[name] = std::move(seg)).get();
+}
+
+void SegmentStore::makeWritable(Segment &seg)
+{
+    if (seg.writable)
+    {
+        return;
+    }
+    int fd = ::open(seg.path.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open segment file " + seg.path + " for writing");
+    }
+    // Mappings of the read-only descriptor stay valid after it is closed
+    ::close(seg.fd);
+    seg.fd = fd;
+    seg.writable = true;
+}
+
+void SegmentStore::load(Segment &seg)
+{
+    struct stat st;
+    if (fstat(seg.fd, &st) != 0)
+    {
+        throw runtime_error("Cannot stat segment file");
+    }
+    uint64_t size = st.st_size;
+
+    Trailer t;
+    if (size >= sizeof(Trailer) && pread(seg.fd, &t, sizeof(Trailer), size - sizeof(Trailer)) == sizeof(Trailer) &&
+        memcmp(t.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 && t.version == SEGMENT_STORE_VERSION &&
+        t.footer_offset + t.num_entries * sizeof(FooterEntry) + sizeof(Trailer) == size)
+    {
+        vector<FooterEntry> footer(t.num_entries);
+        size_t footer_bytes = t.num_entries * sizeof(FooterEntry);
+        if (pread(seg.fd, footer.data(), footer_bytes, t.footer_offset) == (ssize_t)footer_bytes)
+        {
+            for (const FooterEntry &e : footer)
+            {
+                seg.index[entryKey(e.column, e.row)] = Entry{e.offset, e.length, e.level};
+                seg.live_bytes += sizeof(RecordHeader) + e.length;
+            }
+            seg.data_end = t.footer_offset;
+            return;
+        }
+    }
+
+    // No valid footer (the last writer did not flush): rebuild the index from the records
+    seg.index.clear();
+    uint64_t offset = 0;
+    RecordHeader h;
+    while (offset + sizeof(RecordHeader) <= size && pread(seg.fd, &h, sizeof(RecordHeader), offset) == sizeof(RecordHeader))
+    {
+        if (h.magic != RECORD_MAGIC || h.length > size - offset - sizeof(RecordHeader))
+        {
+            break;
+        }
+        seg.index[entryKey(h.column, h.row)] = Entry{offset + sizeof(RecordHeader), h.length, h.level};
+        offset += sizeof(RecordHeader) + h.length;
+    }
+    for (auto &[key, e] : seg.index)
+    {
+        seg.live_bytes += sizeof(RecordHeader) + e.length;
+    }
+    seg.data_end = offset;
+
+    // A read-only segment keeps its tail, the first write truncates it
+    if (seg.writable)
+    {
+        seg.dirty = true;
+        if (offset < size && ftruncate(seg.fd, offset) != 0)
+        {
+            throw runtime_error("Cannot truncate segment file");
+        }
+    }
+}
+
+bool SegmentStore::find(const string &kind, uint32_t column, uint32_t row, Entry &entry, shared_ptr<const Mapping> &mapping) const
+{
+    Segment *seg = segment(kind, column, false);
+    if (seg == nullptr)
+    {
+        return false;
+    }
+
+    lock_guard<mutex> lock(seg->segment_mutex);
+    auto it = seg->index.find(entryKey(column, row));
+    if (it == seg->index.end())
+    {
+        return false;
+    }
+    entry = it->second;
+
+    // Remapped only when the record lies past the current mapping
+    if (!seg->mapping || entry.offset + entry.length > seg->mapping->length)
+    {
+        void *map = mmap(nullptr, seg->data_end, PROT_READ, MAP_SHARED, seg->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            throw runtime_error("Cannot map segment file");
+        }
+        shared_ptr<Mapping> fresh = make_shared<Mapping>();
+        fresh->data = static_cast<const char *>(map);
+        fresh->length = seg->data_end;
+        seg->mapping = fresh;
+    }
+    mapping = seg->mapping;
+    return true;
+}
+
+bool SegmentStore::contains(const string &kind, uint32_t column, uint32_t row) const
+{
+    return level(kind, column, row) >= 0;
+}
+
+long SegmentStore::level(const string &kind, uint32_t column, uint32_t row) const
+{
+    Segment *seg = segment(kind, column, false);
+    if (seg == nullptr)
+    {
+        return -1;
+    }
+
+    lock_guard<mutex> lock(seg->segment_mutex);
+    auto it = seg->index.find(entryKey(column, row));
+    return it == seg->index.end() ? -1 : it->second.level;
+}
+
+helib::Ctxt SegmentStore::read(const string &kind, uint32_t column, uint32_t row, const helib::PubKey &public_key) const
+{
+    Entry entry;
+    shared_ptr<const Mapping> mapping;
+    if (!find(kind, column, row, entry, mapping))
+    {
+        throw invalid_argument("ERROR: no ciphertext stored for " + kind + " column " + to_string(column) + " row " + to_string(row));
+    }
+
+    // Parsed outside the lock, the mapping is kept alive by the shared_ptr
+    MappedStreamBuf buf(mapping->data + entry.offset, entry.length);
+    istream in(&buf);
+    return helib::Ctxt::readFrom(in, public_key);
+}
+
+void SegmentStore::write(const string &kind, uint32_t column, uint32_t row, const helib::Ctxt &ctxt)
+{
+    ostringstream out;
+    ctxt.writeTo(out);
+    string bytes = out.str();
+
+    RecordHeader h;
+    memset(&h, 0, sizeof(RecordHeader));
+    h.magic = RECORD_MAGIC;
+    h.column = column;
+    h.row = row;
+    h.length = bytes.size();
+    h.level = ctxt.getPrimeSet().card();
+
+    Segment *seg = segment(kind, column, true);
+    lock_guard<mutex> lock(seg->segment_mutex);
+
+    // Drop the footer first, a stale trailer must not survive behind the new records
+    if (!seg->dirty && ftruncate(seg->fd, seg->data_end) != 0)
+    {
+        throw runtime_error("Cannot truncate segment file");
+    }
+    seg->dirty = true;
+
+    if (pwrite(seg->fd, &h, sizeof(RecordHeader), seg->data_end) != sizeof(RecordHeader) ||
+        pwrite(seg->fd, bytes.data(), bytes.size(), seg->data_end + sizeof(RecordHeader)) != (ssize_t)bytes.size())
+    {
+        throw runtime_error("Cannot write to segment file");
+    }
+    Entry &entry = seg->index[entryKey(column, row)];
+    if (entry.length > 0)
+    {
+        seg->live_bytes -= sizeof(RecordHeader) + entry.length;
+    }
+    entry = Entry{seg->data_end + sizeof(RecordHeader), h.length, h.level};
+    seg->live_bytes += sizeof(RecordHeader) + bytes.size();
+    seg->data_end += sizeof(RecordHeader) + bytes.size();
+}
+
+void SegmentStore::writeFooter(Segment &seg)
+{
+    vector<FooterEntry> footer = vector<FooterEntry>();
+    footer.reserve(seg.index.size());
+    for (auto &[key, e] : seg.index)
+    {
+        footer.push_back(FooterEntry{uint32_t(key >> 32), uint32_t(key), e.offset, e.length, e.level});
+    }
+
+    Trailer t;
+    memset(&t, 0, sizeof(Trailer));
+    memcpy(t.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    t.version = SEGMENT_STORE_VERSION;
+    t.footer_offset = seg.data_end;
+    t.num_entries = footer.size();
+
+    size_t footer_bytes = footer.size() * sizeof(FooterEntry);
+    if (pwrite(seg.fd, footer.data(), footer_bytes, seg.data_end) != (ssize_t)footer_bytes ||
+        pwrite(seg.fd, &t, sizeof(Trailer), seg.data_end + footer_bytes) != sizeof(Trailer) ||
+        ftruncate(seg.fd, seg.data_end + footer_bytes + sizeof(Trailer)) != 0)
+    {
+        throw runtime_error("Cannot write segment footer");
+    }
+    seg.dirty = false;
+}
+
+void SegmentStore::compactSegment(Segment &seg)
+{
+    string tmp_path = seg.path + ".compact";
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot create segment file " + tmp_path);
+    }
+
+    // Live records in file order, so the copy reads the old file front to back
+    vector<pair<uint64_t, Entry>> live(seg.index.begin(), seg.index.end());
+    sort(live.begin(), live.end(), [](const pair<uint64_t, Entry> &a, const pair<uint64_t, Entry> &b)
+         { return a.second.offset < b.second.offset; });
+
+    unordered_map<uint64_t, Entry> index;
+    uint64_t offset = 0;
+    string record;
+    for (auto &[key, e] : live)
+    {
+        record.resize(sizeof(RecordHeader) + e.length);
+        if (pread(seg.fd, &record[0], record.size(), e.offset - sizeof(RecordHeader)) != (ssize_t)record.size() ||
+            pwrite(fd, record.data(), record.size(), offset) != (ssize_t)record.size())
+        {
+            ::close(fd);
+            remove(tmp_path.c_str());
+            throw runtime_error("Cannot compact segment file " + seg.path);
+        }
+        index[key] = Entry{offset + sizeof(RecordHeader), e.length, e.level};
+        offset += record.size();
+    }
+
+    int old_fd = seg.fd;
+    seg.fd = fd;
+    seg.index = std::move(index);
+    seg.data_end = offset;
+    seg.live_bytes = offset;
+    writeFooter(seg);
+    if (fsync(fd) != 0 || rename(tmp_path.c_str(), seg.path.c_str()) != 0)
+    {
+        throw runtime_error("Cannot replace segment file " + seg.path);
+    }
+
+    // Readers still holding the old mapping keep the old file alive until they drop it
+    ::close(old_fd);
+    seg.mapping.reset();
+}
+
+void SegmentStore::flush()
+{
+    lock_guard<mutex> lock(segments_mutex);
+    for (auto &[name, seg] : segments)
+    {
+        lock_guard<mutex> seg_lock(seg->segment_mutex);
+        if (!seg->dirty)
+        {
+            continue;
+        }
+        uint64_t dead_bytes = seg->data_end - seg->live_bytes;
+        if (dead_bytes >= SEGMENT_COMPACT_MIN_DEAD && dead_bytes > seg->live_bytes)
+        {
+            compactSegment(*seg);
+        }
+        else
+        {
+            writeFooter(*seg);
+        }
+    }
+}
+
+void SegmentStore::compact()
+{
+    // Segments not used since the store was opened are compacted as well
+    for (const auto &file : filesystem::directory_iterator(directory))
+    {
+        string name = file.path().filename().string();
+        size_t separator = name.rfind('_');
+        if (file.path().extension() != ".seg" || separator == string::npos)
+        {
+            continue;
+        }
+        uint32_t index = stoul(file.path().stem().string().substr(separator + 1));
+        segment(name.substr(0, separator), index * SEGMENT_COLUMNS, false);
+    }
+
+    lock_guard<mutex> lock(segments_mutex);
+    for (auto &[name, seg] : segments)
+    {
+        lock_guard<mutex> seg_lock(seg->segment_mutex);
+        if (seg->data_end > seg->live_bytes)
+        {
+            makeWritable(*seg);
+            compactSegment(*seg);
+        }
+        else if (seg->dirty)
+        {
+            writeFooter(*seg);
+        }
+    }
+}
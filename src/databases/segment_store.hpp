@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <helib/helib.h>
+
+using namespace std;
+
+#define SEGMENT_STORE_VERSION 1
+#define SEGMENT_COLUMNS 1024
+// flush() compacts a segment once superseded records take more than half of it and at least this many bytes
+#define SEGMENT_COMPACT_MIN_DEAD (64ull << 20)
+
+// Ciphertexts of SEGMENT_COLUMNS consecutive columns of one kind share a segment file
+// <kind>_<segment>.seg. Each record is a small header followed by the HElib serialization
+// of the ciphertext. The footer lists offset, length and level (number of primes) of the
+// latest record of every (column, row) and the trailer at the end of the file points at it.
+// Records are only ever appended, so mappings taken before an update stay valid, and a
+// missing or stale footer is rebuilt by scanning the records. Compaction copies the live
+// records into a new file that replaces the old one, existing mappings keep the old file.
+// Segments are opened read-only until the first write to them.
+class SegmentStore
+{
+public:
+    explicit SegmentStore(const string &directory);
+    ~SegmentStore();
+
+    SegmentStore(const SegmentStore &) = delete;
+    SegmentStore &operator=(const SegmentStore &) = delete;
+
+    bool contains(const string &kind, uint32_t column, uint32_t row) const;
+    helib::Ctxt read(const string &kind, uint32_t column, uint32_t row, const helib::PubKey &public_key) const;
+    // Number of primes of the stored ciphertext, -1 if there is none
+    long level(const string &kind, uint32_t column, uint32_t row) const;
+
+    // Safe to call from several threads, also for columns of the same segment
+    void write(const string &kind, uint32_t column, uint32_t row, const helib::Ctxt &ctxt);
+    // Writes the footer of every segment changed since the last flush
+    void flush();
+    // Rewrites every segment that holds superseded records, then flushes
+    void compact();
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t length;
+        int64_t level;
+    };
+
+    struct Mapping
+    {
+        const char *data = nullptr;
+        size_t length = 0;
+        ~Mapping();
+    };
+
+    struct Segment
+    {
+        string path;
+        int fd = -1;
+        bool writable = false;
+        uint64_t data_end = 0;
+        // Bytes of the records the index points at, the rest up to data_end is superseded
+        uint64_t live_bytes = 0;
+        bool dirty = false;
+        unordered_map<uint64_t, Entry> index;
+        shared_ptr<const Mapping> mapping;
+        mutex segment_mutex;
+    };
+
+    string directory;
+    mutable mutex segments_mutex;
+    mutable unordered_map<string, unique_ptr<Segment>> segments;
+
+    // Opens the segment on first use, nullptr if it does not exist and create is false
+    Segment *segment(const string &kind, uint32_t column, bool create) const;
+    bool find(const string &kind, uint32_t column, uint32_t row, Entry &entry, shared_ptr<const Mapping> &mapping) const;
+
+    static void load(Segment &seg);
+    static void makeWritable(Segment &seg);
+    static void writeFooter(Segment &seg);
+    static void compactSegment(Segment &seg);
+};
@@ -0,0 +1,191 @@
+#include "thread_pool.hpp"
+
+using namespace std;
+
+ThreadPool::Workers::Workers(uint32_t num_workers)
+{
+    // One queue per worker, the last one is shared by the threads calling parallelFor
+    for (uint32_t i = 0; i <= num_workers; i++)
+    {
+        queues.push_back(make_unique<Queue>());
+    }
+    for (uint32_t i = 0; i < num_workers; i++)
+    {
+        threads.emplace_back(&Workers::workerLoop, this, i);
+    }
+}
+
+ThreadPool::Workers::~Workers()
+{
+    {
+        lock_guard<mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : threads)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::Workers::push(function<void()> task)
+{
+    Queue &queue = *queues[next_queue.fetch_add(1) % queues.size()];
+    lock_guard<mutex> lock(queue.queue_mutex);
+    queue.tasks.push_back(std::move(task));
+}
+
+bool ThreadPool::Workers::tryRun(size_t home)
+{
+    function<void()> task;
+
+    // Own queue from the back, other queues from the front
+    for (size_t k = 0; k < queues.size() && !task; k++)
+    {
+        Queue &queue = *queues[(home + k) % queues.size()];
+        lock_guard<mutex> lock(queue.queue_mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        if (k == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+
+    if (!task)
+    {
+        return false;
+    }
+    pending.fetch_sub(1);
+    task();
+    return true;
+}
+
+void ThreadPool::Workers::workerLoop(size_t index)
+{
+    while (true)
+    {
+        if (tryRun(index))
+        {
+            continue;
+        }
+
+        unique_lock<mutex> lock(wake_mutex);
+        wake.wait(lock, [this]
+                  { return stopping || pending.load() > 0; });
+        if (stopping && pending.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+ThreadPool::ThreadPool(uint32_t num_workers)
+    : workers(make_shared<Workers>(num_workers)), max_parallelism(num_workers + 1)
+{
+}
+
+ThreadPool::ThreadPool(shared_ptr<Workers> workers, uint32_t max_parallelism)
+    : workers(std::move(workers)), max_parallelism(max_parallelism)
+{
+}
+
+shared_ptr<ThreadPool> ThreadPool::limited(uint32_t max_parallelism) const
+{
+    return shared_ptr<ThreadPool>(new ThreadPool(workers, max(1u, min(max_parallelism, concurrency()))));
+}
+
+uint32_t ThreadPool::concurrency() const
+{
+    return min<uint32_t>(max_parallelism, workers->threads.size() + 1);
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, const function<void(size_t)> &fn, uint32_t max_parallelism)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+
+    size_t num_runners = concurrency();
+    if (max_parallelism > 0)
+    {
+        num_runners = min<size_t>(num_runners, max_parallelism);
+    }
+    num_runners = min(num_runners, end - begin);
+    if (num_runners <= 1)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    // Runners claim indices one at a time, so no more than num_runners threads work on
+    // the range. A runner that starts after the range ran out never touches fn.
+    struct Group
+    {
+        atomic<size_t> next;
+        atomic<size_t> remaining;
+        mutex done_mutex;
+        condition_variable done;
+        exception_ptr error;
+    };
+    shared_ptr<Group> group = make_shared<Group>();
+    group->next = begin;
+    group->remaining = end - begin;
+
+    auto run = [group, &fn, end]()
+    {
+        for (size_t i = group->next.fetch_add(1); i < end; i = group->next.fetch_add(1))
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(group->done_mutex);
+                if (!group->error)
+                {
+                    group->error = current_exception();
+                }
+            }
+            if (group->remaining.fetch_sub(1) == 1)
+            {
+                lock_guard<mutex> lock(group->done_mutex);
+                group->done.notify_all();
+            }
+        }
+    };
+
+    {
+        lock_guard<mutex> lock(workers->wake_mutex);
+        workers->pending.fetch_add(num_runners - 1);
+    }
+    for (size_t r = 1; r < num_runners; r++)
+    {
+        workers->push(run);
+    }
+    workers->wake.notify_all();
+
+    // The caller is one of the runners, then waits for the indices still in flight
+    run();
+
+    unique_lock<mutex> lock(group->done_mutex);
+    group->done.wait(lock, [&group]
+                     { return group->remaining.load() == 0; });
+    if (group->error)
+    {
+        rethrow_exception(group->error);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+using namespace std;
+
+// Long-lived work-stealing pool. Every worker owns a deque: it pops its own
+// tasks from the back and steals from the front of the others. The thread
+// calling parallelFor runs tasks as well, so nested parallelFor calls from
+// inside a task cannot starve the pool.
+class ThreadPool
+{
+public:
+    // num_workers background threads, the caller of parallelFor is one more
+    explicit ThreadPool(uint32_t num_workers);
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // A handle on the same workers whose parallelFor calls use at most max_parallelism threads
+    shared_ptr<ThreadPool> limited(uint32_t max_parallelism) const;
+
+    // Threads that execute tasks of one parallelFor, including the caller
+    uint32_t concurrency() const;
+
+    // Runs fn(i) for every i in [begin, end) and returns once all of them finished.
+    // At most max_parallelism threads work on the range, 0 means the limit of this handle.
+    // The first exception thrown by a task is rethrown here.
+    void parallelFor(size_t begin, size_t end, const function<void(size_t)> &fn, uint32_t max_parallelism = 0);
+
+private:
+    struct Queue
+    {
+        deque<function<void()>> tasks;
+        mutex queue_mutex;
+    };
+
+    // Threads and queues, shared by every handle on the pool
+    struct Workers
+    {
+        vector<thread> threads;
+        vector<unique_ptr<Queue>> queues;
+
+        mutex wake_mutex;
+        condition_variable wake;
+        atomic<size_t> pending{0};
+        atomic<size_t> next_queue{0};
+        bool stopping = false;
+
+        explicit Workers(uint32_t num_workers);
+        ~Workers();
+
+        void push(function<void()> task);
+        bool tryRun(size_t home);
+        void workerLoop(size_t index);
+    };
+
+    shared_ptr<Workers> workers;
+    uint32_t max_parallelism;
+
+    ThreadPool(shared_ptr<Workers> workers, uint32_t max_parallelism);
+};
@@ -96,7 +96,8 @@ void simplePolyEval(Ctxt &ret, const NTL::ZZX &poly, DynamicCtxtPowers &babyStep
 // This procedure assumes that poly is monic, deg(poly)=k*(2t-1)+delta
 // with t=2^e, and that babyStep contains >= k+delta powers
 void PatersonStockmeyer(Ctxt &ret, const NTL::ZZX &poly, long k, long t, long delta,
-                        DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep)
+                        DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                        ThreadPool *pool, long spawn_depth)
 {
   if (deg(poly) <= babyStep.size())
   { // Edge condition, use simple eval
@@ -127,6 +128,31 @@ void PatersonStockmeyer(Ctxt &ret, const NTL::ZZX &poly, long k, long t, long de
   s.normalize();
 
   // Evaluate recursively poly = (c+X^{kt})*q + s'
+  if (pool != nullptr && spawn_depth > 0)
+  {
+    // q, c and s' only read the precomputed powers
+    Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
+    Ctxt tmp_s(ret.getPubKey(), ret.getPtxtSpace());
+    pool->parallelFor(0, 3, [&](size_t task)
+                      {
+      if (task == 0)
+      {
+        PatersonStockmeyer(ret, q, k, t / 2, delta, babyStep, giantStep, pool, spawn_depth - 1);
+      }
+      else if (task == 1)
+      {
+        simplePolyEval(tmp, c, babyStep);
+        tmp += giantStep.getPower(t);
+      }
+      else
+      {
+        PatersonStockmeyer(tmp_s, s, k, t / 2, delta, babyStep, giantStep, pool, spawn_depth - 1);
+      } });
+    ret.multiplyBy(tmp);
+    ret += tmp_s;
+    return;
+  }
+
   PatersonStockmeyer(ret, q, k, t / 2, delta, babyStep, giantStep);
 
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
@@ -141,7 +167,8 @@ void PatersonStockmeyer(Ctxt &ret, const NTL::ZZX &poly, long k, long t, long de
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
 // and that babyStep contains >= k + (deg(poly) mod k) powers
 void degPowerOfTwo(Ctxt &ret, const NTL::ZZX &poly, long k,
-                   DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep)
+                   DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                   ThreadPool *pool, long spawn_depth)
 {
   if (deg(poly) <= babyStep.size())
   { // Edge condition, use simple eval
@@ -155,21 +182,42 @@ void degPowerOfTwo(Ctxt &ret, const NTL::ZZX &poly, long k,
   SetCoeff(r, (n - 1) * k);                   // monic, degree == k(2^e-1)
   q -= 1;
 
-  PatersonStockmeyer(ret, r, k, n / 2, 0, babyStep, giantStep);
-
   Ctxt tmp(ret.getPubKey(), ret.getPtxtSpace());
-  simplePolyEval(tmp, q, babyStep); // evaluate q
+  auto evaluate_top = [&]()
+  {
+    simplePolyEval(tmp, q, babyStep); // evaluate q
+
+    // multiply by X^{k(n-1)} with minimum depth
+    for (long i = 1; i < n; i *= 2)
+    {
+      tmp.multiplyBy(giantStep.getPower(i));
+    }
+  };
 
-  // multiply by X^{k(n-1)} with minimum depth
-  for (long i = 1; i < n; i *= 2)
+  if (pool != nullptr && spawn_depth > 0)
   {
-    tmp.multiplyBy(giantStep.getPower(i));
+    pool->parallelFor(0, 2, [&](size_t task)
+                      {
+      if (task == 0)
+      {
+        PatersonStockmeyer(ret, r, k, n / 2, 0, babyStep, giantStep, pool, spawn_depth - 1);
+      }
+      else
+      {
+        evaluate_top();
+      } });
+  }
+  else
+  {
+    PatersonStockmeyer(ret, r, k, n / 2, 0, babyStep, giantStep);
+    evaluate_top();
   }
   ret += tmp;
 }
 
 void recursivePolyEval(Ctxt &ret, const NTL::ZZX &poly, long k,
-                       DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep)
+                       DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                       ThreadPool *pool, long spawn_depth)
 {
   if (deg(poly) <= babyStep.size())
   { // Edge condition, use simple eval
@@ -184,14 +232,14 @@ void recursivePolyEval(Ctxt &ret, const NTL::ZZX &poly, long k,
   // Special case for deg(poly) = k * 2^e +delta
   if (n == t)
   {
-    degPowerOfTwo(ret, poly, k, babyStep, giantStep);
+    degPowerOfTwo(ret, poly, k, babyStep, giantStep, pool, spawn_depth);
     return;
   }
 
   // When deg(poly) = k*(2^e -1) we use the Paterson-Stockmeyer recursion
   if (n == t - 1 && delta == 0)
   {
-    PatersonStockmeyer(ret, poly, k, t / 2, delta, babyStep, giantStep);
+    PatersonStockmeyer(ret, poly, k, t / 2, delta, babyStep, giantStep, pool, spawn_depth);
     return;
   }
 
@@ -207,19 +255,151 @@ void recursivePolyEval(Ctxt &ret, const NTL::ZZX &poly, long k,
   q -= 1;
   SetCoeff(r, u); // degree == u
 
-  PatersonStockmeyer(ret, q, k, t / 2, 0, babyStep, giantStep);
-
+  // X^u may need giant steps that are not powers of two, so it is computed
+  // before the branches below share giantStep
   Ctxt tmp = giantStep.getPower(u / k);
   if (delta != 0)
   { // if u is not divisible by k then compute it
     tmp.multiplyBy(babyStep.getPower(delta));
   }
+
+  if (pool != nullptr && spawn_depth > 0)
+  {
+    // Only the recursivePolyEval branch can still add giant steps
+    Ctxt tmp_r(ret.getPubKey(), ret.getPtxtSpace());
+    pool->parallelFor(0, 2, [&](size_t task)
+                      {
+      if (task == 0)
+      {
+        PatersonStockmeyer(ret, q, k, t / 2, 0, babyStep, giantStep, pool, spawn_depth - 1);
+        ret.multiplyBy(tmp);
+      }
+      else
+      {
+        recursivePolyEval(tmp_r, r, k, babyStep, giantStep, pool, spawn_depth - 1);
+      } });
+    ret += tmp_r;
+    return;
+  }
+
+  PatersonStockmeyer(ret, q, k, t / 2, 0, babyStep, giantStep);
   ret.multiplyBy(tmp);
 
   recursivePolyEval(tmp, r, k, babyStep, giantStep);
   ret += tmp;
 }
 
+void computePowersParallel(DynamicCtxtPowers &powers, long n, ThreadPool &pool)
+{
+  // getPower(e) multiplies X^{2^j} by X^{e-2^j} for e in (2^j, 2^{j+1}], so the
+  // products of one level only read the levels below
+  for (long level = 1; level < n; level *= 2)
+  {
+    long end = min(2 * level, n);
+    pool.parallelFor(level + 1, end + 1, [&](size_t e)
+                     { powers.getPower(e); });
+  }
+}
+
+long polyEvalSpawnDepth(const ThreadPool *pool)
+{
+  if (pool == nullptr)
+  {
+    return 0;
+  }
+  // Enough levels for about two branches per thread
+  long depth = 0;
+  while ((1L << depth) < 2 * (long)pool->concurrency())
+  {
+    depth++;
+  }
+  return depth;
+}
+
+void parallelPolyEval(Ctxt &ret, const NTL::ZZX &poly, const Ctxt &x, ThreadPool *pool)
+{
+  if (deg(poly) <= 2)
+  { // Edge condition, use simple eval
+    DynamicCtxtPowers powers(x, max(deg(poly), 1L));
+    simplePolyEval(ret, poly, powers);
+    return;
+  }
+
+  // How many baby steps: set k~sqrt(n/2), rounded up/down to a power of two
+  long kk = static_cast<long>(sqrt(deg(poly) / 2.0));
+  long k = 1L << NextPowerOfTwo(kk);
+  if ((k == 16 && deg(poly) > 167) || (k > 16 && k > (1.44 * kk)))
+    k /= 2;
+
+  long n = divc(deg(poly), k); // n = ceil(deg(p)/k), deg(p) >= k*n
+  long spawn_depth = polyEvalSpawnDepth(pool);
+
+  DynamicCtxtPowers babyStep(x, k);
+  if (pool != nullptr)
+  {
+    computePowersParallel(babyStep, k, *pool);
+  }
+  const Ctxt &xk = babyStep.getPower(k);
+
+  // Special case when deg(p)>k*(2^e -1)
+  if (n == (1L << NextPowerOfTwo(n)))
+  {
+    DynamicCtxtPowers giantStep(xk, n / 2);
+    for (long i = 1; pool != nullptr && i <= n / 2; i *= 2)
+    {
+      giantStep.getPower(i);
+    }
+    degPowerOfTwo(ret, poly, k, babyStep, giantStep, pool, spawn_depth);
+    return;
+  }
+
+  // If n is not a power of two, ensure that poly is monic and that
+  // its degree is divisible by k, then call the recursive procedure
+  const ZZ p = to_ZZ(x.getPtxtSpace());
+  ZZ top = LeadCoeff(poly);
+  ZZ topInv;
+  bool divisible = (n * k == deg(poly));
+  long nonInvertible = InvModStatus(topInv, top, p);
+
+  ZZX tmp = poly;
+  ZZ extra = ZZ::zero(); // extra!=0 denotes an added term extra*X^{k*n}
+  if (!divisible || nonInvertible)
+  {
+    top = to_ZZ(1);
+    topInv = top;
+    extra = SubMod(top, coeff(poly, n * k), p);
+    SetCoeff(tmp, n * k);
+  }
+
+  long t = IsZero(extra) ? divc(n, 2) : n;
+  DynamicCtxtPowers giantStep(xk, t);
+  for (long i = 1; pool != nullptr && i <= t; i *= 2)
+  {
+    giantStep.getPower(i);
+  }
+
+  if (!IsOne(top))
+  {
+    tmp *= topInv; // Multiply by topInv to make into a monic polynomial
+    for (long i = 0; i <= n * k; i++)
+      rem(tmp[i], tmp[i], p);
+    tmp.normalize();
+  }
+
+  recursivePolyEval(ret, tmp, k, babyStep, giantStep, pool, spawn_depth);
+
+  if (!IsOne(top))
+  {
+    ret.multByConstant(top);
+  }
+  if (!IsZero(extra))
+  { // if we added a term, now is the time to subtract back
+    Ctxt topTerm = giantStep.getPower(n);
+    topTerm.multByConstant(extra);
+    ret -= topTerm;
+  }
+}
+
 // Function to find modulo inverse of a
 int modInverse(int A, int M)
 {
@@ -294,7 +474,7 @@ Ctxt multiplyMany(vector<Ctxt> &v)
     uint32_t jump_factor = pow(2, d);
     uint32_t skip_factor = 2 * jump_factor;
 
-    for (uint32_t i = 0; i < num_entries; i += skip_factor)
+    for (uint32_t i = 0; i + jump_factor < num_entries; i += skip_factor)
     {
       v[i].multiplyBy(v[i + jump_factor]);
     }
@@ -312,7 +492,7 @@ Ctxt addMany(vector<Ctxt> &v)
     uint32_t jump_factor = pow(2, d);
     uint32_t skip_factor = 2 * jump_factor;
 
-    for (uint32_t i = 0; i < num_entries; i += skip_factor)
+    for (uint32_t i = 0; i + jump_factor < num_entries; i += skip_factor)
     {
       v[i] += v[i + jump_factor];
     }
@@ -331,6 +511,45 @@ Ctxt addManySafe(vector<Ctxt> &v, const PubKey &pk)
   return result;
 }
 
+Ctxt addManyParallel(vector<Ctxt> &v, const PubKey &pk, ThreadPool &pool)
+{
+  if (v.size() == 0)
+  {
+    return Ctxt(pk);
+  }
+
+  size_t num_entries = v.size();
+  for (size_t jump_factor = 1; jump_factor < num_entries; jump_factor *= 2)
+  {
+    size_t skip_factor = 2 * jump_factor;
+    pool.parallelFor(0, (num_entries + skip_factor - 1) / skip_factor, [&](size_t k)
+                     {
+      size_t i = k * skip_factor;
+      if (i + jump_factor < num_entries)
+      {
+        v[i] += v[i + jump_factor];
+      } });
+  }
+  return v[0];
+}
+
+Ctxt multiplyManyParallel(vector<Ctxt> &v, ThreadPool &pool)
+{
+  size_t num_entries = v.size();
+  for (size_t jump_factor = 1; jump_factor < num_entries; jump_factor *= 2)
+  {
+    size_t skip_factor = 2 * jump_factor;
+    pool.parallelFor(0, (num_entries + skip_factor - 1) / skip_factor, [&](size_t k)
+                     {
+      size_t i = k * skip_factor;
+      if (i + jump_factor < num_entries)
+      {
+        v[i].multiplyBy(v[i + jump_factor]);
+      } });
+  }
+  return v[0];
+}
+
 void addOneMod2(Ctxt &a)
 {
     //   0 -> 1
@@ -338,4 +557,65 @@ void addOneMod2(Ctxt &a)
     // f(x)-> -x+1
     a.negate();
     a.addConstant(NTL::ZZX(1));
-}
\ No newline at end of file
+}
+
+void useNTLThreadPool()
+{
+  thread_local bool sized = false;
+  if (sized)
+  {
+    return;
+  }
+  long threads = max(1u, std::thread::hardware_concurrency());
+  if (NTL::AvailableThreads() < threads)
+  {
+    NTL::SetNumThreads(threads);
+  }
+  sized = true;
+}
+
+void addSquareNoRelin(Ctxt &sum, const Ctxt &a)
+{
+  // operator*= leaves the degree-2 part in place, unlike square()
+  Ctxt square = a;
+  square *= a;
+  sum += square;
+}
+
+void addSquashMatrices(SecKey &secretKey, long levels)
+{
+  const Context &context = secretKey.getContext();
+  const EncryptedArray &ea = context.getEA();
+  const PAlgebra &zMStar = context.getZMStar();
+
+  for (long dim = 0; dim < ea.dimension(); dim++)
+  {
+    if (!ea.nativeDimension(dim))
+    {
+      continue;
+    }
+    long size = ea.sizeOfDimension(dim);
+
+    // Rotations by -k * 2^e along the dimension, for every k < 2^levels
+    for (long step = 1; step < size; step *= 2)
+    {
+      for (long k = 1; k < (1L << levels) && k * step < size; k++)
+      {
+        long automorphism = zMStar.genToPow(dim, size - k * step);
+        if (!secretKey.haveKeySWmatrix(1, automorphism, 0, 0))
+        {
+          secretKey.GenKeySWmatrix(1, automorphism, 0, 0);
+        }
+      }
+    }
+  }
+  secretKey.setKeySwitchMap();
+}
+
+void addComparatorMatrices(SecKey &secretKey, long slot_degree)
+{
+  if (slot_degree > 1)
+  {
+    addFrbMatrices(secretKey);
+  }
+}
@@ -10,6 +10,9 @@ Auxiliary functions for integer encoding
 #include <helib/helib.h>
 #include <helib/Ctxt.h>
 #include <helib/polyEval.h>
+#include <NTL/BasicThreadPool.h>
+#include "thread_pool.hpp"
+#include "key_store.hpp"
 
 using namespace std;
 using namespace helib;
@@ -37,15 +40,27 @@ void simplePolyEval(Ctxt &ret, const NTL::ZZX &poly, DynamicCtxtPowers &babyStep
 // polynomial-evaluation algorithm from SIAM J. on Computing, 1973.
 // This procedure assumes that poly is monic, deg(poly)=k*(2t-1)+delta
 // with t=2^e, and that babyStep contains >= k+delta powers
-void PatersonStockmeyer(Ctxt &ret, const NTL::ZZX &poly, long k, long t, long delta, DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep);
+// With a pool, the independent halves of the top spawn_depth levels run as
+// tasks; all baby steps and the giant steps 2^i must be computed beforehand.
+void PatersonStockmeyer(Ctxt &ret, const NTL::ZZX &poly, long k, long t, long delta, DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                        ThreadPool *pool = nullptr, long spawn_depth = 0);
 
 // This procedure assumes that k*(2^e +1) > deg(poly) > k*(2^e -1),
 // and that babyStep contains >= k + (deg(poly) mod k) powers
 void degPowerOfTwo(Ctxt &ret, const NTL::ZZX &poly, long k,
-                   DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep);
+                   DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                   ThreadPool *pool = nullptr, long spawn_depth = 0);
 
 void recursivePolyEval(Ctxt &ret, const NTL::ZZX &poly, long k,
-                       DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep);
+                       DynamicCtxtPowers &babyStep, DynamicCtxtPowers &giantStep,
+                       ThreadPool *pool = nullptr, long spawn_depth = 0);
+
+// Computes powers 1..n level by level, the products of one level run on the pool
+void computePowersParallel(DynamicCtxtPowers &powers, long n, ThreadPool &pool);
+// Levels of the Paterson-Stockmeyer recursion that are split into tasks for a pool
+long polyEvalSpawnDepth(const ThreadPool *pool);
+// Same as helib::polyEval, with the recursion run on the pool when one is given
+void parallelPolyEval(Ctxt &ret, const NTL::ZZX &poly, const Ctxt &x, ThreadPool *pool);
 
 // From Geeks for Geeks
 // Function for extended Euclidean Algorithm
@@ -62,7 +77,25 @@ void print_vector(const vector<T, Allocator> &vect, int num_entries = 10);
 Ctxt addMany(vector<Ctxt> &v);
 Ctxt addManySafe(vector<Ctxt> &v, const PubKey &pk);
 Ctxt multiplyMany(vector<Ctxt> &v);
+// Same pairwise trees, every level runs its disjoint pairs on the pool
+Ctxt addManyParallel(vector<Ctxt> &v, const PubKey &pk, ThreadPool &pool);
+Ctxt multiplyManyParallel(vector<Ctxt> &v, ThreadPool &pool);
 void addOneMod2(Ctxt &a);
+// sum += a * a without relinearizing, sum needs a cleanUp() once it is complete
+void addSquareNoRelin(Ctxt &sum, const Ctxt &a);
+
+// NTL keeps one thread pool per calling thread. Sizes the calling thread's pool to the
+// hardware the first time it runs on that thread and leaves it alone afterwards, so no
+// query creates or joins NTL threads after the first one.
+void useNTLThreadPool();
+
+// Halving steps of the hoisted squash that share one key-switch decomposition
+#define SQUASH_HOIST_LEVELS 2
+
+// Direct key-switching matrices for the rotations used by the hoisted squash
+void addSquashMatrices(SecKey &secretKey, long levels);
+// Direct Frobenius matrices for the comparator digit extraction, only needed when d > 1
+void addComparatorMatrices(SecKey &secretKey, long slot_degree);
 
 struct Params
 {
@@ -122,38 +155,30 @@ struct ContextAndKeys
                                           secretKey(context),
                                           publicKey((secretKey.GenSecKey(),
                                                      addSome1DMatrices(secretKey),
+                                                     addSquashMatrices(secretKey, SQUASH_HOIST_LEVELS),
+                                                     addComparatorMatrices(secretKey, params.d),
                                                      secretKey)),
                                           ea(context.getEA())
   {
   }
 
-  // Constructor for loading ContextAndKeys from a file
-  ContextAndKeys(const std::string &filename, const Params &_params) : params(_params),
-                                                context(loadContextFromFile(filename + ".context")),
-                                                secretKey(loadSecKeyFromFile(filename + ".pubkey", context)),
-                                                publicKey(loadPubKeyFromFile(filename + ".seckey", context)),
-                                                ea(context.getEA())
+  // Constructor for loading ContextAndKeys from a file. Reads the key store when there
+  // is one and falls back to the separate files written by older versions.
+  ContextAndKeys(const std::string &filename, const Params &_params) : ContextAndKeys(filename, _params, openKeyStore(filename))
   {
   }
 
   void saveToFile(const std::string &filename) const
   {
-    std::ofstream ofs(filename + ".context", std::ios::binary);
-    if (!ofs)
-    {
-      throw std::runtime_error("Cannot open file for writing");
-    }
-    // Save context
-    context.writeTo(ofs);
-    ofs.close();
-
-    ofs.open(filename + ".pubkey", std::ios::binary);
-    secretKey.writeTo(ofs);
-    ofs.close();
+    // The public key is the public part of the secret key, so it is not stored twice
+    KeyStore::write(filename + ".keystore", context, nullptr, &secretKey);
+  }
 
-    ofs.open(filename + ".seckey", std::ios::binary);
-    publicKey.writeTo(ofs);
-    ofs.close();
+  static std::unique_ptr<KeyStore> openKeyStore(const std::string &filename)
+  {
+    std::unique_ptr<KeyStore> store = std::make_unique<KeyStore>();
+    store->open(filename + ".keystore");
+    return store;
   }
 
   static helib::Context loadContextFromFile(const std::string &filename)
@@ -185,6 +210,15 @@ struct ContextAndKeys
     }
     return helib::PubKey::readFrom(ifs, context);
   }
+
+private:
+  ContextAndKeys(const std::string &filename, const Params &_params, std::unique_ptr<KeyStore> store) : params(_params),
+                                                context(store->isOpen() ? store->readContext() : loadContextFromFile(filename + ".context")),
+                                                secretKey(store->isOpen() ? store->readSecKey(context) : loadSecKeyFromFile(filename + ".pubkey", context)),
+                                                publicKey(!store->isOpen() ? loadPubKeyFromFile(filename + ".seckey", context) : store->has(KeyStore::PUBLIC_KEY) ? store->readPubKey(context) : helib::PubKey(secretKey)),
+                                                ea(context.getEA())
+  {
+  }
 };
 
 struct Meta
@@ -0,0 +1,273 @@
+#include "vcf_reader.hpp"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#define VCF_FIXED_FIELDS 9
+#define VCF_ID_FIELD 2
+
+static const int8_t ALLELE_MISSING = -1;
+static const int8_t ALLELE_INVALID = -2;
+
+// Alternate allele count of a single-character allele
+static array<int8_t, 256> makeAlleleTable()
+{
+    array<int8_t, 256> table;
+    table.fill(ALLELE_INVALID);
+    table['0'] = 0;
+    for (char c = '1'; c <= '9'; c++)
+    {
+        table[(uint8_t)c] = 1;
+    }
+    table['.'] = ALLELE_MISSING;
+    return table;
+}
+
+static const array<int8_t, 256> ALLELES = makeAlleleTable();
+
+// First tab in [p, end), end if there is none
+static const char *findTab(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i tabs = _mm_set1_epi8('\t');
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tabs));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    const char *tab = static_cast<const char *>(memchr(p, '\t', end - p));
+    return tab == nullptr ? end : tab;
+}
+
+// Decodes the GT subfield at the start of a sample field
+static int32_t decodeGenotype(const char *p, const char *end)
+{
+    // Common case: two single-character alleles, e.g. 0/1, 1|1 or ./.
+    if (end - p >= 3 && (end - p == 3 || p[3] == ':') && (p[1] == '/' || p[1] == '|'))
+    {
+        int8_t a = ALLELES[(uint8_t)p[0]];
+        int8_t b = ALLELES[(uint8_t)p[2]];
+        if (a >= 0 && b >= 0)
+        {
+            return a + b;
+        }
+        if (a != ALLELE_INVALID && b != ALLELE_INVALID)
+        {
+            return -1;
+        }
+    }
+
+    // Any ploidy and multi-digit allele indices, e.g. 0/12 or 1
+    int32_t dosage = 0;
+    bool missing = false;
+    while (p < end && *p != ':')
+    {
+        if (*p == '.')
+        {
+            missing = true;
+            p++;
+        }
+        else if (*p >= '0' && *p <= '9')
+        {
+            bool reference = true;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                reference = reference && *p == '0';
+                p++;
+            }
+            dosage += reference ? 0 : 1;
+        }
+        else if (*p != '/' && *p != '|')
+        {
+            return -1;
+        }
+        else
+        {
+            p++;
+        }
+    }
+    return missing ? -1 : dosage;
+}
+
+VCFReader::~VCFReader()
+{
+    close();
+}
+
+void VCFReader::close()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<char *>(data), length);
+    }
+    data = nullptr;
+    length = 0;
+    position = 0;
+    line_number = 0;
+    num_samples = 0;
+}
+
+bool VCFReader::open(const string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    // An empty file has nothing to map and no lines
+    if (st.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(map);
+    length = st.st_size;
+    return true;
+}
+
+bool VCFReader::nextLine(Line &line)
+{
+    while (position < length)
+    {
+        const char *begin = data + position;
+        const char *newline = static_cast<const char *>(memchr(begin, '\n', length - position));
+        const char *end = newline == nullptr ? data + length : newline;
+        position = end - data + 1;
+        line_number++;
+
+        if (end > begin && end[-1] == '\r')
+        {
+            end--;
+        }
+        // Skip header lines starting with "#"
+        if (end == begin || *begin == '#')
+        {
+            continue;
+        }
+        line = Line{begin, end, line_number};
+        return true;
+    }
+    return false;
+}
+
+void VCFReader::checkSamples(const Line &line, size_t count)
+{
+    if (num_samples == 0)
+    {
+        num_samples = count;
+    }
+    else if (count != num_samples)
+    {
+        throw invalid_argument("ERROR: VCF line " + to_string(line.number) + " has " + to_string(count) +
+                               " genotypes, expected " + to_string(num_samples));
+    }
+}
+
+void VCFReader::parseLine(const Line &line, string &snp_name, vector<int32_t> &genotypes)
+{
+    genotypes.clear();
+
+    uint32_t field = 0;
+    const char *p = line.begin;
+    while (p <= line.end)
+    {
+        const char *tab = findTab(p, line.end);
+        if (field == VCF_ID_FIELD)
+        {
+            snp_name.assign(p, tab);
+        }
+        // An empty field is a trailing tab, not a sample
+        else if (field >= VCF_FIXED_FIELDS && tab > p)
+        {
+            genotypes.push_back(decodeGenotype(p, tab));
+        }
+        field++;
+        p = tab + 1;
+    }
+}
+
+bool VCFReader::next(string &snp_name, vector<int32_t> &genotypes)
+{
+    Line line;
+    if (!nextLine(line))
+    {
+        return false;
+    }
+    genotypes.reserve(num_samples);
+    parseLine(line, snp_name, genotypes);
+    checkSamples(line, genotypes.size());
+    return true;
+}
+
+uint32_t VCFReader::nextBatch(uint32_t max_lines, vector<string> &snp_names, vector<vector<int32_t>> &genotypes, ThreadPool *pool)
+{
+    // Only the line boundaries are found serially, the fields are parsed in parallel
+    vector<Line> lines = vector<Line>();
+    Line line;
+    while (lines.size() < max_lines && nextLine(line))
+    {
+        lines.push_back(line);
+    }
+
+    snp_names.resize(lines.size());
+    genotypes.resize(lines.size());
+    size_t num_ranges = pool == nullptr ? 1 : min<size_t>(pool->concurrency(), lines.size());
+    auto parse_range = [&](size_t range)
+    {
+        size_t begin = range * lines.size() / num_ranges;
+        size_t end = (range + 1) * lines.size() / num_ranges;
+        for (size_t i = begin; i < end; i++)
+        {
+            genotypes[i].reserve(num_samples);
+            parseLine(lines[i], snp_names[i], genotypes[i]);
+        }
+    };
+    if (pool == nullptr)
+    {
+        parse_range(0);
+    }
+    else
+    {
+        pool->parallelFor(0, num_ranges, parse_range);
+    }
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        checkSamples(lines[i], genotypes[i].size());
+    }
+    return lines.size();
+}
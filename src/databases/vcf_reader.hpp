@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// Reads a VCF one SNP line at a time, so ingestion never holds more than the lines it is
+// working on. The file is memory-mapped and fields are found by scanning for tabs 16 bytes
+// at a time. The first nine fields of a line are the fixed VCF columns, the ID field names
+// the SNP and every field after FORMAT is one sample, whose GT subfield is decoded into the
+// number of alternate alleles: 0 for 0/0, 1 for 0/1 or 1|0, 2 for 1/1 or 1/2, and -1 when
+// an allele is missing.
+class VCFReader
+{
+public:
+    VCFReader() = default;
+    ~VCFReader();
+
+    VCFReader(const VCFReader &) = delete;
+    VCFReader &operator=(const VCFReader &) = delete;
+
+    // False when the file cannot be opened
+    bool open(const string &path);
+    void close();
+
+    // False at the end of the file. Throws when a line has another number of samples
+    // than the first one.
+    bool next(string &snp_name, vector<int32_t> &genotypes);
+    // Up to max_lines SNP lines, parsed in line ranges spread over the pool. Returns the
+    // number of lines read, 0 at the end of the file.
+    uint32_t nextBatch(uint32_t max_lines, vector<string> &snp_names, vector<vector<int32_t>> &genotypes, ThreadPool *pool = nullptr);
+
+    // Samples per line, 0 before the first line was read
+    uint32_t numSamples() const { return num_samples; }
+
+private:
+    struct Line
+    {
+        const char *begin;
+        const char *end;
+        uint64_t number;
+    };
+
+    const char *data = nullptr;
+    size_t length = 0;
+    size_t position = 0;
+    uint64_t line_number = 0;
+    uint32_t num_samples = 0;
+
+    // Next SNP line after the current position, false at the end of the file
+    bool nextLine(Line &line);
+    void checkSamples(const Line &line, size_t count);
+
+    static void parseLine(const Line &line, string &snp_name, vector<int32_t> &genotypes);
+};
@@ -0,0 +1,103 @@
+#include "zero_pool.hpp"
+
+using namespace std;
+
+ZeroEncryptionPool::ZeroEncryptionPool(const helib::PubKey &_public_key, size_t _capacity, uint32_t _num_threads)
+    : public_key(_public_key), capacity(_capacity), num_threads(_num_threads)
+{
+}
+
+void ZeroEncryptionPool::startRefill()
+{
+    if (!threads.empty() || capacity == 0)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < num_threads; i++)
+    {
+        threads.emplace_back(&ZeroEncryptionPool::refillLoop, this);
+    }
+}
+
+ZeroEncryptionPool::~ZeroEncryptionPool()
+{
+    {
+        lock_guard<mutex> lock(ready_mutex);
+        stopping = true;
+    }
+    refill.notify_all();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+helib::Ctxt ZeroEncryptionPool::encryptZero() const
+{
+    helib::Ctxt ctxt(public_key);
+    NTL::ZZX zero;
+    public_key.Encrypt(ctxt, zero);
+    return ctxt;
+}
+
+helib::Ctxt ZeroEncryptionPool::take()
+{
+    {
+        lock_guard<mutex> lock(ready_mutex);
+        startRefill();
+        if (!ready.empty())
+        {
+            helib::Ctxt ctxt = std::move(ready.front());
+            ready.pop_front();
+            refill.notify_one();
+            return ctxt;
+        }
+    }
+    return encryptZero();
+}
+
+size_t ZeroEncryptionPool::available() const
+{
+    lock_guard<mutex> lock(ready_mutex);
+    return ready.size();
+}
+
+void ZeroEncryptionPool::setCapacity(size_t _capacity)
+{
+    {
+        lock_guard<mutex> lock(ready_mutex);
+        capacity = _capacity;
+        while (ready.size() > capacity)
+        {
+            ready.pop_back();
+        }
+        startRefill();
+    }
+    refill.notify_all();
+}
+
+void ZeroEncryptionPool::refillLoop()
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(ready_mutex);
+            refill.wait(lock, [&]
+                        { return stopping || ready.size() < capacity; });
+            if (stopping)
+            {
+                return;
+            }
+        }
+
+        // Encrypted outside the lock, take keeps serving while the pool refills. With several
+        // threads the last round may overshoot, the extra ciphertexts are dropped below.
+        helib::Ctxt ctxt = encryptZero();
+
+        lock_guard<mutex> lock(ready_mutex);
+        if (ready.size() < capacity)
+        {
+            ready.push_back(std::move(ctxt));
+        }
+    }
+}
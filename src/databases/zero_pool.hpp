@@ -0,0 +1,52 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <helib/helib.h>
+
+using namespace std;
+
+#define DEFAULT_ZERO_POOL_SIZE 8
+#define DEFAULT_ZERO_POOL_THREADS 1
+
+// Fresh public-key encryptions of zero, made ahead of time by background threads. Adding
+// a plaintext to one of them gives a fresh encryption of that plaintext, so DML pays for
+// a plaintext addition instead of an encryption. Every ciphertext is handed out once.
+// The refill threads start on the first take() or setCapacity(), read-only workloads
+// never pay for them.
+class ZeroEncryptionPool
+{
+public:
+    ZeroEncryptionPool(const helib::PubKey &public_key, size_t capacity = DEFAULT_ZERO_POOL_SIZE, uint32_t num_threads = DEFAULT_ZERO_POOL_THREADS);
+    ~ZeroEncryptionPool();
+
+    ZeroEncryptionPool(const ZeroEncryptionPool &) = delete;
+    ZeroEncryptionPool &operator=(const ZeroEncryptionPool &) = delete;
+
+    // Encrypts on the calling thread when the pool has run dry
+    helib::Ctxt take();
+
+    size_t available() const;
+    // A capacity of 0 stops the refill, take then always encrypts
+    void setCapacity(size_t capacity);
+
+private:
+    const helib::PubKey &public_key;
+    size_t capacity;
+    uint32_t num_threads;
+    bool stopping = false;
+
+    mutable mutex ready_mutex;
+    condition_variable refill;
+    deque<helib::Ctxt> ready;
+    vector<thread> threads;
+
+    helib::Ctxt encryptZero() const;
+    // Called with ready_mutex held
+    void startRefill();
+    void refillLoop();
+};
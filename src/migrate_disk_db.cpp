@@ -0,0 +1,63 @@
+#include "./databases/FHE_disk_database.hpp"
+#include "globals.hpp"
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+struct Config {
+    int threads = std::thread::hardware_concurrency();
+    bool keep_files = false;
+};
+
+void print_help() {
+    std::cout << "Moves the disk database from one file per ciphertext into segment files.\n";
+    std::cout << "A database that already uses segment files is compacted instead.\n";
+    std::cout << "Usage:\n";
+    std::cout << "  --threads <int>     Specify number of threads (default: all cores)\n";
+    std::cout << "  --keep              Keep the old per-ciphertext files after migrating\n";
+    std::cout << "  --help              Display this help message\n";
+}
+
+bool parse_arguments(int argc, char* argv[], Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--help") {
+            print_help();
+            return false;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            config.threads = std::stoi(argv[++i]);
+        } else if (arg == "--keep") {
+            config.keep_files = true;
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            print_help();
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+
+    if (!parse_arguments(argc, argv, config)) {
+        return 1;
+    }
+
+    FHEDiskDatabase *dbFHEInstance = new FHEDiskDatabase(constants::Large, "", false);
+    if (dbFHEInstance->usesSegments()) {
+        dbFHEInstance->compactSegments();
+        delete dbFHEInstance;
+        std::cout << "Database already uses segment files, compacted them." << std::endl;
+        return 0;
+    }
+
+    dbFHEInstance->migrateToSegments(config.keep_files, config.threads);
+    delete dbFHEInstance;
+
+    std::cout << "Database migrated successfully." << std::endl;
+
+    return 0;
+}
@@ -178,6 +178,26 @@ TEST_F(FHESIMDDatabaseTest, MAFRangeQuery)
     ASSERT_EQ(true_dom, dom);
 }
 
+TEST_F(FHESIMDDatabaseTest, CountRangeQueryParallelComparison)
+{
+    uint32_t low_query = 2;
+    uint32_t high_query = 5;
+    FHESIMDDatabaseTest::dbFHEInstance->setComparisonThreads(2);
+    auto result_encrypted = FHESIMDDatabaseTest::dbFHEInstance->countingRangeQuery(low_query, high_query, 0);
+    FHESIMDDatabaseTest::dbFHEInstance->setComparisonThreads(1);
+    auto result = FHESIMDDatabaseTest::dbFHEInstance->decrypt(result_encrypted);
+
+    auto result_long = aggregate(result, result_encrypted.nAggregates);
+
+    uint32_t true_count = FHESIMDDatabaseTest::dbInstance->countingRangeQuery(low_query, high_query, 0);
+
+    cout << "Running Counting query with a parallel comparison (pheno 0 in [2, 5])" << endl;
+    cout << "Pred: " << result_long << endl;
+    cout << "True: " << true_count << endl;
+
+    ASSERT_EQ(true_count, result_long);
+}
+
 // Add more tests as needed
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
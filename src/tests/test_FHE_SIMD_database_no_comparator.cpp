@@ -94,6 +94,22 @@ TEST_F(FHESIMDDatabaseTestNoComp, CountingQueryOr2)
     ASSERT_EQ(true_count, result);
 }
 
+TEST_F(FHESIMDDatabaseTestNoComp, CountingQueryOrSameColumn)
+{
+    vector<pair<uint32_t, uint32_t>> query;
+    query = vector<pair<uint32_t, uint32_t>>{pair(0, 1), pair(0, 2), pair(1, 0)};
+    auto result_encrypted = FHESIMDDatabaseTestNoComp::dbFHEInstance->countQuery(0, query);
+    auto result = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(result_encrypted)[0];
+
+    uint32_t true_count = FHESIMDDatabaseTestNoComp::dbInstance->countQuery(0, query);
+
+    cout << "Running Counting query (snp 0 = 1 or snp 0 = 2 or snp 1 = 0)" << endl;
+    cout << "Pred: " << result << endl;
+    cout << "True: " << true_count << endl;
+
+    ASSERT_EQ(true_count, result);
+}
+
 TEST_F(FHESIMDDatabaseTestNoComp, MAFQuery)
 {
     vector<pair<uint32_t, uint32_t>> query;
@@ -187,6 +203,202 @@ TEST_F(FHESIMDDatabaseTestNoComp, PRSQueryParallel)
 }
 
 
+TEST_F(FHESIMDDatabaseTestNoComp, CountingQueryIndicatorColumns)
+{
+    FHESIMDDatabase dbIndicators(constants::Test, false);
+    dbIndicators.setIndicatorColumns(true);
+    dbIndicators.genData(num_rows, num_snp_cols, ::testing::UnitTest::GetInstance()->random_seed());
+
+    vector<pair<uint32_t, uint32_t>> query;
+    query = vector<pair<uint32_t, uint32_t>>{pair(0, 0), pair(1, 1)};
+    auto result_encrypted = dbIndicators.countQuery(1, query);
+    auto result = dbIndicators.decrypt(result_encrypted)[0];
+
+    uint32_t true_count = FHESIMDDatabaseTestNoComp::dbInstance->countQuery(1, query);
+
+    cout << "Running Counting query with indicator columns (snp 0 = 0 and snp 1 = 1)" << endl;
+    cout << "Pred: " << result << endl;
+    cout << "True: " << true_count << endl;
+
+    ASSERT_EQ(true_count, result);
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, CountingQueryHoistedSquash)
+{
+    vector<pair<uint32_t, uint32_t>> query;
+    query = vector<pair<uint32_t, uint32_t>>{pair(0, 0), pair(1, 1)};
+
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->setSquashKernel(SquashKernel::Hoisted);
+    auto result_encrypted = FHESIMDDatabaseTestNoComp::dbFHEInstance->countQuery(1, query);
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->setSquashKernel(SquashKernel::LogTime);
+    auto result = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(result_encrypted)[0];
+
+    uint32_t true_count = FHESIMDDatabaseTestNoComp::dbInstance->countQuery(1, query);
+
+    cout << "Running Counting query with the hoisted squash kernel (snp 0 = 0 and snp 1 = 1)" << endl;
+    cout << "Pred: " << result << endl;
+    cout << "True: " << true_count << endl;
+
+    ASSERT_EQ(true_count, result);
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, BatchCountingQuery)
+{
+    vector<CountQuery> batch = vector<CountQuery>();
+    batch.push_back(CountQuery{true, vector<pair<uint32_t, uint32_t>>{pair(0, 0), pair(1, 1)}});
+    batch.push_back(CountQuery{false, vector<pair<uint32_t, uint32_t>>{pair(0, 1), pair(2, 2)}});
+    batch.push_back(CountQuery{true, vector<pair<uint32_t, uint32_t>>{pair(2, 0)}});
+
+    auto result_encrypted = FHESIMDDatabaseTestNoComp::dbFHEInstance->batchCountQuery(batch);
+    auto result = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(result_encrypted);
+    long stride = result_encrypted.nAggregates > 0 ? result_encrypted.nAggregates : 1;
+
+    cout << "Running batch of three Counting queries" << endl;
+    for (uint32_t q = 0; q < batch.size(); q++)
+    {
+        long pred = 0;
+        for (long i = 0; i < stride; i++)
+        {
+            pred += result[q * stride + i];
+        }
+        uint32_t true_count = FHESIMDDatabaseTestNoComp::dbInstance->countQuery(batch[q].conjunctive, batch[q].filter);
+
+        cout << "Pred: " << pred << endl;
+        cout << "True: " << true_count << endl;
+
+        ASSERT_EQ(true_count, pred);
+    }
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, ExecuteCountingQuery)
+{
+    vector<pair<uint32_t, uint32_t>> query;
+    query = vector<pair<uint32_t, uint32_t>>{pair(0, 0), pair(1, 1), pair(2, 2)};
+
+    for (bool conjunctive : {true, false})
+    {
+        auto result_encrypted = FHESIMDDatabaseTestNoComp::dbFHEInstance->executeCountQuery(conjunctive, query, num_threads);
+        auto result = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(result_encrypted)[0];
+
+        uint32_t true_count = FHESIMDDatabaseTestNoComp::dbInstance->countQuery(conjunctive, query);
+
+        cout << "Running executed Counting query (conjunctive = " << conjunctive << ")" << endl;
+        cout << "Pred: " << result << endl;
+        cout << "True: " << true_count << endl;
+
+        ASSERT_EQ(true_count, result);
+    }
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, GenotypeView)
+{
+    for (uint32_t column = 0; column < num_snp_cols; column++)
+    {
+        CtxtHandle view = FHESIMDDatabaseTestNoComp::dbFHEInstance->viewGenotype(column, 0);
+        auto viewed = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(*view);
+        auto copied = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(column, 0));
+
+        ASSERT_EQ(copied, viewed);
+    }
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, ZeroPoolUpdatesDecrypt)
+{
+    long p = FHESIMDDatabaseTestNoComp::dbFHEInstance->getMeta().data->context.getP();
+    auto before = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0));
+
+    // Updates add to the stored value, the second one undoes the first
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->updateOneValue(1, 0, 1);
+    auto updated = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0));
+    ASSERT_EQ((before[1] + 1) % p, updated[1]);
+    ASSERT_EQ(before[0], updated[0]);
+
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->updateOneValue(1, 0, p - 1);
+    ASSERT_EQ(before, FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0)));
+
+    ASSERT_EQ(FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->encryptFast(5))[0], 5);
+
+    // Nothing is encrypted ahead of time until the pool is first used
+    ZeroEncryptionPool pool(FHESIMDDatabaseTestNoComp::dbFHEInstance->getMeta().data->publicKey, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(pool.available(), 0u);
+    pool.take();
+    for (uint32_t wait = 0; wait < 1000 && pool.available() == 0; wait++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_GT(pool.available(), 0u);
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, UpdateManyCoalescesCells)
+{
+    long p = FHESIMDDatabaseTestNoComp::dbFHEInstance->getMeta().data->context.getP();
+    auto before = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(1, 0));
+
+    // Two updates of the same cell add up
+    vector<CellUpdate> updates = vector<CellUpdate>{{0, 1, 1}, {2, 1, 2}, {2, 1, 3}};
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->updateMany(updates);
+    auto updated = FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(1, 0));
+    ASSERT_EQ((before[0] + 1) % p, updated[0]);
+    ASSERT_EQ(before[1], updated[1]);
+    ASSERT_EQ((before[2] + 5) % p, updated[2]);
+
+    vector<CellUpdate> undo = vector<CellUpdate>{{0, 1, uint32_t(p - 1)}, {2, 1, uint32_t(p - 5)}};
+    FHESIMDDatabaseTestNoComp::dbFHEInstance->updateMany(undo);
+    ASSERT_EQ(before, FHESIMDDatabaseTestNoComp::dbFHEInstance->decrypt(FHESIMDDatabaseTestNoComp::dbFHEInstance->getGenotype(1, 0)));
+
+    vector<CellUpdate> out_of_bounds = vector<CellUpdate>{{0, num_snp_cols, 1}};
+    ASSERT_THROW(FHESIMDDatabaseTestNoComp::dbFHEInstance->updateMany(out_of_bounds), invalid_argument);
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, FlushInsertsAppendsRows)
+{
+    // Own database, the shared one must keep its row count
+    FHESIMDDatabase db(constants::Test, false);
+    db.genData(2, 2, 1);
+    auto before = db.decrypt(db.getGenotype(1, 0));
+
+    vector<uint32_t> row_a = vector<uint32_t>{1, 2};
+    vector<uint32_t> row_b = vector<uint32_t>{0, 1};
+    db.insertOneRow(row_a);
+    db.insertOneRow(row_b);
+    ASSERT_EQ(db.stagedRows(), 2u);
+    ASSERT_EQ(db.num_rows, 2u);
+
+    db.flushInserts();
+    ASSERT_EQ(db.stagedRows(), 0u);
+    ASSERT_EQ(db.num_rows, 4u);
+
+    auto after = db.decrypt(db.getGenotype(1, 0));
+    ASSERT_EQ(before[0], after[0]);
+    ASSERT_EQ(before[1], after[1]);
+    ASSERT_EQ(after[2], 2);
+    ASSERT_EQ(after[3], 1);
+
+    vector<uint32_t> short_row = vector<uint32_t>{1};
+    ASSERT_THROW(db.insertOneRow(short_row), invalid_argument);
+}
+
+TEST_F(FHESIMDDatabaseTestNoComp, FlushAfterOutOfRangeUpdate)
+{
+    FHESIMDDatabase db(constants::Test, false);
+    db.genData(2, 2, 1);
+
+    // Row 2 is padding until an insert is flushed, an update there would be added to the insert
+    ASSERT_THROW(db.updateOneValue(2, 0, 1), invalid_argument);
+    vector<uint32_t> row = vector<uint32_t>{1, 2};
+    db.insertOneRow(row);
+    ASSERT_THROW(db.updateOneValue(2, 0, 1), invalid_argument);
+
+    db.flushInserts();
+    auto after = db.decrypt(db.getGenotype(0, 0));
+    ASSERT_EQ(after[2], 1);
+    ASSERT_EQ(after[3], 0);
+
+    db.updateOneValue(2, 0, 1);
+    ASSERT_EQ(db.decrypt(db.getGenotype(0, 0))[2], 2);
+}
+
 // Add more tests as needed
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
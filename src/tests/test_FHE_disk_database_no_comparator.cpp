@@ -185,6 +185,214 @@ TEST_F(FHEDIskDatabaseTestNoComp, PRSQueryParallel)
     }
 }
 
+TEST_F(FHEDIskDatabaseTestNoComp, SegmentFilesHoldGenotypes)
+{
+    ASSERT_TRUE(FHEDIskDatabaseTestNoComp::dbFHEInstance->usesSegments());
+
+    for (uint32_t c = 0; c < num_snp_cols; c++)
+    {
+        auto result = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(c, 0));
+        for (uint32_t i = 0; i < num_rows; i++)
+        {
+            ASSERT_EQ(FHEDIskDatabaseTestNoComp::dbInstance->getGenotype(c, i), result[i]);
+        }
+    }
+}
+TEST_F(FHEDIskDatabaseTestNoComp, CompactionDropsSupersededCiphertexts)
+{
+    long p = FHEDIskDatabaseTestNoComp::dbFHEInstance->getMeta().data->context.getP();
+    std::string segment_file = getProjectRootPath() + DISK_DIR + "/" + SEGMENT_DIR + "/genotype_0.seg";
+
+    // The second update undoes the first, both append a new genotype ciphertext
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->updateOneValue(0, 0, 1);
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->updateOneValue(0, 0, p - 1);
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->storeDBMetadata();
+    auto grown = std::filesystem::file_size(segment_file);
+
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->compactSegments();
+    ASSERT_LT(std::filesystem::file_size(segment_file), grown);
+
+    for (uint32_t c = 0; c < num_snp_cols; c++)
+    {
+        auto result = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(c, 0));
+        for (uint32_t i = 0; i < num_rows; i++)
+        {
+            ASSERT_EQ(FHEDIskDatabaseTestNoComp::dbInstance->getGenotype(c, i), result[i]);
+        }
+    }
+}
+
+TEST_F(FHEDIskDatabaseTestNoComp, CacheServesRepeatedReads)
+{
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->pinColumn(0);
+    auto first = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0));
+    CtxtCache::Stats before = FHEDIskDatabaseTestNoComp::dbFHEInstance->cacheStats();
+
+    auto second = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0));
+    CtxtCache::Stats after = FHEDIskDatabaseTestNoComp::dbFHEInstance->cacheStats();
+
+    ASSERT_EQ(first, second);
+    ASSERT_EQ(before.hits + 1, after.hits);
+    ASSERT_EQ(before.misses, after.misses);
+
+    // A budget of zero still keeps the pinned column
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->setCacheBudget(0);
+    ASSERT_GE(FHEDIskDatabaseTestNoComp::dbFHEInstance->cacheStats().entries, 1u);
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->setCacheBudget(DEFAULT_CTXT_CACHE_BYTES);
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->unpinColumn(0);
+}
+
+TEST_F(FHEDIskDatabaseTestNoComp, ReadAheadFillsCache)
+{
+    // Start from an empty cache so the query reads what the I/O threads loaded
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->setCacheBudget(0);
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->setCacheBudget(DEFAULT_CTXT_CACHE_BYTES);
+
+    vector<pair<uint32_t, int>> query;
+    query = vector<pair<uint32_t, int>>{pair(0, 2), pair(1, 3), pair(2, 1)};
+    auto result_encrypted = FHEDIskDatabaseTestNoComp::dbFHEInstance->PRSQueryPP(query, num_threads);
+    vector<vector<long>> decrypted = vector<vector<long>>();
+    for (auto &ctxt : result_encrypted)
+    {
+        decrypted.push_back(FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(ctxt));
+    }
+
+    auto true_result = FHEDIskDatabaseTestNoComp::dbInstance->PRSQuery(query);
+
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        ASSERT_EQ(true_result[i], decrypted[i / decrypted[0].size()][i % decrypted[0].size()]);
+    }
+    ASSERT_GE(FHEDIskDatabaseTestNoComp::dbFHEInstance->cacheStats().entries, 3u);
+}
+
+TEST(FHEDiskDatabaseMigration, MovesFilesIntoSegments)
+{
+    const uint32_t num_snp_cols = 3;
+    const uint32_t num_rows = 5;
+    const uint32_t seed = 7;
+    std::string disk_dir = (std::filesystem::temp_directory_path() / "squid_migration_test").string();
+    std::filesystem::remove_all(disk_dir);
+
+    // One file per ciphertext, the layout written before segment files
+    FHEDiskDatabase db(constants::Test, false, disk_dir, false);
+    PlaintextDatabase plain;
+    db.genData(num_rows, num_snp_cols, seed);
+    plain.genData(num_rows, num_snp_cols, seed);
+    db.genBinaryPhenoData(1, seed);
+    plain.genBinaryPhenoData(1, seed);
+    ASSERT_FALSE(db.usesSegments());
+    ASSERT_TRUE(std::filesystem::exists(disk_dir + "/0/0.ctxt"));
+
+    // A missing file stops the migration and the database keeps reading the old files
+    std::filesystem::rename(disk_dir + "/2/0.ctxt", disk_dir + "/2/0.ctxt.moved");
+    ASSERT_THROW(db.migrateToSegments(false, 2), invalid_argument);
+    ASSERT_FALSE(db.usesSegments());
+    ASSERT_EQ(db.decrypt(db.getGenotype(0, 0))[0], plain.getGenotype(0, 0));
+    std::filesystem::rename(disk_dir + "/2/0.ctxt.moved", disk_dir + "/2/0.ctxt");
+
+    db.migrateToSegments(false, 2);
+    ASSERT_TRUE(db.usesSegments());
+    for (uint32_t c = 0; c < num_snp_cols; c++)
+    {
+        auto result = db.decrypt(db.getGenotype(c, 0));
+        for (uint32_t i = 0; i < num_rows; i++)
+        {
+            ASSERT_EQ(plain.getGenotype(c, i), result[i]);
+        }
+        ASSERT_FALSE(std::filesystem::exists(disk_dir + "/" + std::to_string(c)));
+        ASSERT_FALSE(std::filesystem::exists(disk_dir + "/" + std::to_string(c) + "_eq0"));
+    }
+    auto pheno = db.decrypt(db.getBinaryPheno(0, 0));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        ASSERT_EQ(plain.getBinaryPheno(0, i), pheno[i]);
+    }
+    ASSERT_FALSE(std::filesystem::exists(disk_dir + "/0_binary"));
+
+    std::filesystem::remove_all(disk_dir);
+}
+
+TEST(FHEDiskDatabasePhenotypes, ParsesPhenotypeFile)
+{
+    const uint32_t num_rows = 4;
+    std::string disk_dir = (std::filesystem::temp_directory_path() / "squid_pheno_test").string();
+    std::string pheno_file = (std::filesystem::temp_directory_path() / "squid_pheno_test.csv").string();
+    std::filesystem::remove_all(disk_dir);
+
+    FHEDiskDatabase db(constants::Test, false, disk_dir, true);
+    db.genData(num_rows, 2, 7);
+
+    auto writePhenoFile = [&pheno_file](const std::string &contents)
+    {
+        std::ofstream out(pheno_file, std::ios::binary);
+        out << contents;
+    };
+
+    // CRLF endings, an NA turns the column it is in continuous
+    writePhenoFile("case,age\r\n1,30\r\n0,NA\r\n1,45\r\n0,52\r\n");
+    db.setPhenoData(pheno_file);
+    ASSERT_EQ(db.num_binary_pheno_cols, 1u);
+    ASSERT_EQ(db.num_continuous_pheno_cols, 1u);
+    ASSERT_EQ(db.getBinaryPhenoHeaders(), vector<string>{"case"});
+    ASSERT_EQ(db.getContinuousPhenoHeaders(), vector<string>{"age"});
+
+    // NA is stored as -1
+    const long modulus = power_long(constants::Test.p, constants::Test.r);
+    vector<long> binary = vector<long>{1, 0, 1, 0};
+    vector<long> continuous = vector<long>{30, modulus - 1, 45, 52};
+    auto binary_result = db.decrypt(db.getBinaryPheno(0, 0));
+    auto continuous_result = db.decrypt(db.getContinuousPheno(0, 0));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        ASSERT_EQ(binary[i], binary_result[i]);
+        ASSERT_EQ(continuous[i], continuous_result[i]);
+    }
+
+    writePhenoFile("case,age\r\n1,30\r\n0,NA,7\r\n1,45\r\n0,52\r\n");
+    ASSERT_THROW(db.setPhenoData(pheno_file), invalid_argument);
+    writePhenoFile("case,age\r\n1,30\r\n0\r\n1,45\r\n0,52\r\n");
+    ASSERT_THROW(db.setPhenoData(pheno_file), invalid_argument);
+    writePhenoFile("case,age\r\n1,30\r\n0,NA\r\n1,45\r\n");
+    ASSERT_THROW(db.setPhenoData(pheno_file), invalid_argument);
+
+    std::filesystem::remove(pheno_file);
+    std::filesystem::remove_all(disk_dir);
+}
+
+// Changes the row count, kept last so the other tests compare against the generated rows
+TEST_F(FHEDIskDatabaseTestNoComp, FlushInsertsGrowsDiskDatabase)
+{
+    uint32_t slots = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(0, 0)).size();
+    uint32_t rows = FHEDIskDatabaseTestNoComp::dbFHEInstance->getNumRows();
+
+    // Fills the last compressed row and starts a new one
+    uint32_t num_inserted = slots - rows % slots + 1;
+    vector<uint32_t> row = vector<uint32_t>{1, 2, 0};
+    for (uint32_t i = 0; i < num_inserted; i++)
+    {
+        FHEDIskDatabaseTestNoComp::dbFHEInstance->insertOneRow(row);
+    }
+    FHEDIskDatabaseTestNoComp::dbFHEInstance->flushInserts();
+    ASSERT_EQ(FHEDIskDatabaseTestNoComp::dbFHEInstance->getNumRows(), rows + num_inserted);
+
+    uint32_t last = rows + num_inserted - 1;
+    for (uint32_t c = 0; c < num_snp_cols; c++)
+    {
+        auto result = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getGenotype(c, last / slots));
+        ASSERT_EQ(result[last % slots], row[c]);
+    }
+
+    // Phenotypes of the new compressed row are stored as zeros
+    auto pheno = FHEDIskDatabaseTestNoComp::dbFHEInstance->decrypt(FHEDIskDatabaseTestNoComp::dbFHEInstance->getBinaryPheno(0, last / slots));
+    ASSERT_EQ(pheno, vector<long>(slots, 0));
+
+    // The row count is stored for the next run
+    std::ifstream meta_file(FHEDIskDatabaseTestNoComp::dbFHEInstance->DISK_DIR_FULL + "/" + DB_META_FILE);
+    uint32_t stored_rows = 0;
+    meta_file >> stored_rows;
+    ASSERT_EQ(stored_rows, rows + num_inserted);
+}
 
 // Add more tests as needed
 int main(int argc, char **argv) {
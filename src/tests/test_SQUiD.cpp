@@ -1,6 +1,7 @@
 #include "../databases/plaintext_database.hpp"
 #include "../databases/FHE_SIMD_database.hpp"
 #include <gtest/gtest.h>
+#include <filesystem>
 
 class SQUiDTest : public ::testing::Test
 {
@@ -144,6 +145,28 @@ TEST_F(SQUiDTest, ContextAndKeysSaveAndLoad)
     ASSERT_EQ(meta.data->context, meta2.data->context);
 }
 
+TEST_F(SQUiDTest, KeyStoreKeysDecrypt)
+{
+    Meta meta;
+    meta(constants::SmallNoSim);
+
+    std::string path = (std::filesystem::temp_directory_path() / "test_key_store").string();
+    meta.data->saveToFile(path);
+    Meta meta2;
+    meta2(path, constants::SmallNoSim);
+
+    helib::Ptxt<helib::BGV> ptxt(meta2.data->context);
+    ptxt[0] = 7;
+    helib::Ctxt ctxt(meta2.data->publicKey);
+    meta2.data->publicKey.Encrypt(ctxt, ptxt);
+
+    helib::Ptxt<helib::BGV> decrypted(meta2.data->context);
+    meta2.data->secretKey.Decrypt(decrypted, ctxt);
+    ASSERT_EQ((long)decrypted.getSlotRepr()[0], 7);
+
+    std::filesystem::remove(path + ".keystore");
+}
+
 // Add more tests as needed
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
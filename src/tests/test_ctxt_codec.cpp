@@ -0,0 +1,60 @@
+#include "../databases/ctxt_codec.hpp"
+#include "../databases/tools.hpp"
+#include "../globals.hpp"
+#include <gtest/gtest.h>
+
+// Ciphertexts of 0, 1, 2, ... in the first slot
+static vector<helib::Ctxt> encryptCounters(const Meta &meta, uint32_t count)
+{
+    vector<helib::Ctxt> ctxts = vector<helib::Ctxt>();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        helib::Ptxt<helib::BGV> ptxt(meta.data->context);
+        ptxt[0] = i;
+        helib::Ctxt ctxt(meta.data->publicKey);
+        meta.data->publicKey.Encrypt(ctxt, ptxt);
+        ctxts.push_back(ctxt);
+    }
+    return ctxts;
+}
+
+static long decryptFirstSlot(const Meta &meta, const helib::Ctxt &ctxt)
+{
+    helib::Ptxt<helib::BGV> ptxt(meta.data->context);
+    meta.data->secretKey.Decrypt(ptxt, ctxt);
+    return (long)ptxt.getSlotRepr()[0];
+}
+
+TEST(CtxtCodecTest, BatchRoundTrip)
+{
+    Meta meta;
+    meta(constants::Test);
+    vector<helib::Ctxt> ctxts = encryptCounters(meta, 3);
+
+    string bytes = encodeCtxtBatch(ctxts);
+    ASSERT_TRUE(isCtxtBatch(bytes.data(), bytes.size()));
+
+    ThreadPool pool(2);
+    vector<helib::Ctxt> decoded = decodeCtxtBatch(bytes.data(), bytes.size(), meta.data->publicKey, &pool);
+    ASSERT_EQ(ctxts.size(), decoded.size());
+    for (size_t i = 0; i < ctxts.size(); i++)
+    {
+        ASSERT_EQ(decryptFirstSlot(meta, decoded[i]), long(i));
+    }
+}
+
+TEST(CtxtCodecTest, RejectsTruncatedBatch)
+{
+    Meta meta;
+    meta(constants::Test);
+    string bytes = encodeCtxtBatch(encryptCounters(meta, 2));
+
+    ASSERT_THROW(decodeCtxtBatch(bytes.data(), bytes.size() / 2, meta.data->publicKey), invalid_argument);
+    ASSERT_FALSE(isCtxtBatch("{\"content\"", 11));
+}
+
+// Add more tests as needed
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
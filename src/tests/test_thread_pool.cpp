@@ -0,0 +1,70 @@
+#include "../databases/thread_pool.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+
+TEST(ThreadPoolTest, RunsEveryIndexWithNestedCalls)
+{
+    ThreadPool pool(3);
+    vector<long> out = vector<long>(32, 0);
+    pool.parallelFor(0, out.size(), [&](size_t i)
+                     {
+        vector<long> inner = vector<long>(8, 0);
+        pool.parallelFor(0, inner.size(), [&](size_t j)
+                         { inner[j] = i * j; });
+        long sum = 0;
+        for (long value : inner)
+        {
+            sum += value;
+        }
+        out[i] = sum; });
+
+    for (uint32_t i = 0; i < out.size(); i++)
+    {
+        ASSERT_EQ(out[i], long(i) * 28);
+    }
+}
+
+TEST(ThreadPoolTest, RethrowsTaskErrors)
+{
+    ThreadPool pool(2);
+    ASSERT_THROW(pool.parallelFor(0, 8, [](size_t i)
+                                  {
+        if (i == 5)
+        {
+            throw invalid_argument("ERROR: task failed");
+        } }),
+                 invalid_argument);
+}
+
+TEST(ThreadPoolTest, LimitsParallelism)
+{
+    ThreadPool pool(3);
+    shared_ptr<ThreadPool> limited = pool.limited(2);
+    ASSERT_EQ(limited->concurrency(), 2u);
+
+    std::atomic<uint32_t> active{0};
+    std::atomic<uint32_t> peak{0};
+    vector<uint32_t> out = vector<uint32_t>(64, 0);
+    limited->parallelFor(0, out.size(), [&](size_t i)
+                         {
+        uint32_t now = ++active;
+        uint32_t seen = peak.load();
+        while (now > seen && !peak.compare_exchange_weak(seen, now))
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        out[i] = i;
+        --active; });
+
+    ASSERT_LE(peak.load(), 2u);
+    for (uint32_t i = 0; i < out.size(); i++)
+    {
+        ASSERT_EQ(out[i], i);
+    }
+}
+
+// Add more tests as needed
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,71 @@
+#include "../databases/vcf_reader.hpp"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+TEST(VCFReaderTest, StreamsLines)
+{
+    std::string path = (std::filesystem::temp_directory_path() / "test_reader.vcf").string();
+    std::ofstream vcf(path);
+    vcf << "##fileformat=VCFv4.2\n";
+    vcf << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS0\tS1\tS2\tS3\n";
+    vcf << "1\t100\trs1\tA\tG\t.\tPASS\t.\tGT\t0/0\t0|1\t1|1\t./.\n";
+    vcf << "1\t200\trs2\tC\tT\t.\tPASS\t.\tGT\t1|0\t1/1\t0/0\t0/1\n";
+    vcf << "1\t300\trs3\tG\tA\t.\tPASS\t.\tGT\t0/0\t0/0\n";
+    vcf.close();
+
+    VCFReader reader;
+    ASSERT_TRUE(reader.open(path));
+    string name;
+    vector<int32_t> genotypes;
+
+    ASSERT_TRUE(reader.next(name, genotypes));
+    ASSERT_EQ(name, "rs1");
+    ASSERT_EQ(genotypes, (vector<int32_t>{0, 1, 2, -1}));
+
+    ASSERT_TRUE(reader.next(name, genotypes));
+    ASSERT_EQ(name, "rs2");
+    ASSERT_EQ(genotypes, (vector<int32_t>{1, 2, 0, 1}));
+    ASSERT_EQ(reader.numSamples(), 4u);
+
+    // A line with fewer samples than the first one
+    ASSERT_THROW(reader.next(name, genotypes), invalid_argument);
+    ASSERT_FALSE(reader.next(name, genotypes));
+
+    std::filesystem::remove(path);
+}
+
+TEST(VCFReaderTest, ParsesBatches)
+{
+    std::string path = (std::filesystem::temp_directory_path() / "test_reader_batch.vcf").string();
+    std::ofstream vcf(path);
+    vcf << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS0\tS1\tS2\tS3\n";
+    for (uint32_t line = 0; line < 10; line++)
+    {
+        // Multi-allelic, multi-digit and haploid calls, FORMAT subfields after GT
+        vcf << "1\t" << line << "\trs" << line << "\tA\tG,T\t.\tPASS\t.\tGT:DP\t1/2:4\t0/12:7\t1:3\t.|0:1\t\r\n";
+    }
+    vcf.close();
+
+    VCFReader reader;
+    ASSERT_TRUE(reader.open(path));
+    ThreadPool pool(2);
+    vector<string> names;
+    vector<vector<int32_t>> genotypes;
+
+    ASSERT_EQ(reader.nextBatch(8, names, genotypes, &pool), 8u);
+    ASSERT_EQ(names[7], "rs7");
+    ASSERT_EQ(genotypes[7], (vector<int32_t>{2, 1, 1, -1}));
+    ASSERT_EQ(reader.nextBatch(8, names, genotypes, &pool), 2u);
+    ASSERT_EQ(names[1], "rs9");
+    ASSERT_EQ(reader.nextBatch(8, names, genotypes, &pool), 0u);
+
+    std::filesystem::remove(path);
+}
+
+// Add more tests as needed
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}